@@ -0,0 +1,539 @@
+/*
+ * Field-sensitive Andersen points-to analysis
+ *
+ * For licensing details see LICENSE
+ */
+
+#include <llvm/IR/GetElementPtrTypeIterator.h>
+#include <llvm/IR/IntrinsicInst.h>
+
+#include <algorithm>
+
+#include "Andersen.h"
+
+using namespace llvm;
+
+const unsigned Andersen::None;
+
+unsigned Andersen::newNode() {
+  unsigned n = Nodes.size();
+  Nodes.emplace_back();
+  Nodes.back().rep = n;
+  return n;
+}
+
+unsigned Andersen::find(unsigned n) {
+  unsigned root = n;
+  while (Nodes[root].rep != root)
+    root = Nodes[root].rep;
+  while (Nodes[n].rep != root) {
+    unsigned next = Nodes[n].rep;
+    Nodes[n].rep = root;
+    n = next;
+  }
+  return root;
+}
+
+unsigned Andersen::findConst(unsigned n) const {
+  while (Nodes[n].rep != n)
+    n = Nodes[n].rep;
+  return n;
+}
+
+// b goes into a. an object keeps its base and offset, only what it points
+// to is shared
+void Andersen::unite(unsigned a, unsigned b) {
+  Node &A = Nodes[a], &B = Nodes[b];
+  A.pts |= B.pts;
+  A.copyTo |= B.copyTo;
+  // what either side hasn't pushed yet is pushed again
+  A.propagated &= B.propagated;
+  A.processed &= B.processed;
+  A.complex.insert(A.complex.end(), B.complex.begin(), B.complex.end());
+  B.rep = a;
+  B.pts.clear();
+  B.propagated.clear();
+  B.processed.clear();
+  B.copyTo.clear();
+  B.complex.clear();
+  ++Collapsed;
+}
+
+const Value *Andersen::getDefinition(const Value *V) const {
+  auto *GV = dyn_cast<GlobalValue>(V);
+  if (!GV || !GV->isDeclaration() || GV->hasLocalLinkage())
+    return V;
+  auto itr = Definitions.find(GV->getName());
+  return itr == Definitions.end() ? V : itr->second;
+}
+
+unsigned Andersen::getObjectNode(const Value *V) {
+  auto itr = ObjectNodes.find(V);
+  if (itr != ObjectNodes.end())
+    return itr->second;
+
+  unsigned n = newNode();
+  Nodes[n].base = n;
+  Nodes[n].obj = V;
+  ObjectNodes[V] = n;
+  ++NumObjects;
+  return n;
+}
+
+unsigned Andersen::getFieldNode(unsigned obj, int64_t offset) {
+  unsigned base = Nodes[obj].base;
+  offset += Nodes[obj].offset;
+  // before the object, or too far past it to tell
+  if (offset < 0 || offset > MaxOffset)
+    offset = 0;
+  if (offset == 0)
+    return base;
+
+  auto key = std::make_pair(base, offset);
+  auto itr = Fields.find(key);
+  if (itr != Fields.end())
+    return itr->second;
+
+  unsigned n = newNode();
+  Nodes[n].base = base;
+  Nodes[n].offset = offset;
+  Fields[key] = n;
+  ++NumObjects;
+  return n;
+}
+
+unsigned Andersen::getReturnNode(const Function *F) {
+  auto itr = ReturnNodes.find(F);
+  if (itr != ReturnNodes.end())
+    return itr->second;
+  unsigned n = newNode();
+  ReturnNodes[F] = n;
+  return n;
+}
+
+// struct fields count, array elements and whole objects stepped over don't.
+// a single constant index into i8 is byte arithmetic, container_of among it
+int64_t Andersen::getGEPOffset(const GEPOperator *GEP) {
+  if (GEP->getNumIndices() == 1) {
+    auto *C = dyn_cast<ConstantInt>(GEP->getOperand(1));
+    if (C && GEP->getSourceElementType()->isIntegerTy(8))
+      return C->getSExtValue();
+    return 0;
+  }
+
+  int64_t offset = 0;
+  for (auto GTI = gep_type_begin(GEP), E = gep_type_end(GEP); GTI != E;
+       ++GTI) {
+    if (StructType *ST = GTI.getStructTypeOrNull()) {
+      auto *C = cast<ConstantInt>(GTI.getOperand());
+      offset += DL->getStructLayout(ST)->getElementOffset(C->getZExtValue());
+    }
+  }
+  return offset;
+}
+
+unsigned Andersen::getValueNode(const Value *V) {
+  if (!V->getType()->isPointerTy())
+    return None;
+  V = getDefinition(V);
+  auto itr = ValueNodes.find(V);
+  if (itr != ValueNodes.end())
+    return itr->second;
+
+  unsigned n = None;
+  if (isa<GlobalObject>(V)) {
+    unsigned obj = getObjectNode(V);
+    n = newNode();
+    Nodes[n].pts.set(obj);
+  } else if (auto *GA = dyn_cast<GlobalAlias>(V)) {
+    n = getValueNode(GA->getAliasee());
+  } else if (auto *CE = dyn_cast<ConstantExpr>(V)) {
+    switch (CE->getOpcode()) {
+    case Instruction::BitCast:
+    case Instruction::AddrSpaceCast:
+      n = getValueNode(CE->getOperand(0));
+      break;
+    case Instruction::GetElementPtr: {
+      unsigned base = getValueNode(CE->getOperand(0));
+      int64_t offset = getGEPOffset(cast<GEPOperator>(CE));
+      if (base == None || offset == 0) {
+        n = base;
+      } else {
+        n = newNode();
+        addOffset(base, n, offset);
+      }
+      break;
+    }
+    case Instruction::IntToPtr:
+      // the round trip of a pointer through an integer
+      if (auto *PI = dyn_cast<PtrToIntOperator>(CE->getOperand(0)))
+        n = getValueNode(PI->getPointerOperand());
+      break;
+    default:
+      break;
+    }
+  } else if (!isa<Constant>(V)) {
+    // instructions and arguments, constrained as they are visited
+    n = newNode();
+  }
+  // null, undef and the like point nowhere
+  ValueNodes[V] = n;
+  return n;
+}
+
+void Andersen::addCopy(unsigned from, unsigned to) {
+  if (from != None && to != None && from != to)
+    Nodes[from].copyTo.set(to);
+}
+
+void Andersen::addOffset(unsigned from, unsigned to, int64_t offset) {
+  if (offset == 0)
+    addCopy(from, to);
+  else
+    addComplex(from, Complex::Offset, to, offset);
+}
+
+void Andersen::addComplex(unsigned n, Complex::Kind kind, unsigned other,
+                          int64_t offset) {
+  if (n != None && other != None)
+    Nodes[n].complex.push_back(Complex{kind, other, offset});
+}
+
+// the pointers in a global's initializer are stored to its fields, the
+// elements of an array all to the same one
+void Andersen::addInitializer(unsigned obj, const Constant *C,
+                              int64_t offset) {
+  if (C->getType()->isPointerTy()) {
+    unsigned n = getValueNode(C);
+    if (n != None)
+      addCopy(n, getFieldNode(obj, offset));
+    return;
+  }
+  if (auto *CS = dyn_cast<ConstantStruct>(C)) {
+    const StructLayout *SL = DL->getStructLayout(CS->getType());
+    for (unsigned i = 0; i < CS->getNumOperands(); ++i)
+      addInitializer(obj, CS->getOperand(i),
+                     offset + SL->getElementOffset(i));
+  } else if (isa<ConstantArray>(C) || isa<ConstantVector>(C)) {
+    for (const Use &U : C->operands())
+      addInitializer(obj, cast<Constant>(U.get()), offset);
+  }
+}
+
+void Andersen::addModule(Module *M) {
+  Modules.push_back(M);
+  for (GlobalValue &GV : M->global_values()) {
+    if (!GV.isDeclaration() && !GV.hasLocalLinkage())
+      Definitions.insert(std::make_pair(GV.getName(), &GV));
+  }
+}
+
+void Andersen::addFunction(Function *F) {
+  for (BasicBlock &BB : *F) {
+    for (Instruction &I : BB)
+      addInstruction(&I);
+  }
+}
+
+void Andersen::addInstruction(Instruction *I) {
+  if (auto *AI = dyn_cast<AllocaInst>(I)) {
+    unsigned obj = getObjectNode(AI);
+    Nodes[getValueNode(AI)].pts.set(obj);
+  } else if (isa<BitCastInst>(I) || isa<AddrSpaceCastInst>(I)) {
+    addCopy(getValueNode(I->getOperand(0)), getValueNode(I));
+  } else if (isa<IntToPtrInst>(I)) {
+    if (auto *PI = dyn_cast<PtrToIntOperator>(I->getOperand(0)))
+      addCopy(getValueNode(PI->getPointerOperand()), getValueNode(I));
+  } else if (auto *GEP = dyn_cast<GetElementPtrInst>(I)) {
+    addOffset(getValueNode(GEP->getPointerOperand()), getValueNode(GEP),
+              getGEPOffset(cast<GEPOperator>(GEP)));
+  } else if (auto *PN = dyn_cast<PHINode>(I)) {
+    for (Value *In : PN->incoming_values())
+      addCopy(getValueNode(In), getValueNode(PN));
+  } else if (auto *SI = dyn_cast<SelectInst>(I)) {
+    addCopy(getValueNode(SI->getTrueValue()), getValueNode(SI));
+    addCopy(getValueNode(SI->getFalseValue()), getValueNode(SI));
+  } else if (auto *LI = dyn_cast<LoadInst>(I)) {
+    addComplex(getValueNode(LI->getPointerOperand()), Complex::Load,
+               getValueNode(LI));
+  } else if (auto *SI = dyn_cast<StoreInst>(I)) {
+    addComplex(getValueNode(SI->getPointerOperand()), Complex::Store,
+               getValueNode(SI->getValueOperand()));
+  } else if (auto *RI = dyn_cast<ReturnInst>(I)) {
+    Value *RV = RI->getReturnValue();
+    unsigned n = RV ? getValueNode(RV) : None;
+    if (n != None)
+      addCopy(n, getReturnNode(RI->getFunction()));
+  } else if (auto *CB = dyn_cast<CallBase>(I)) {
+    addCall(CB);
+  }
+}
+
+void Andersen::addCall(CallBase *CB) {
+  // only the first field is copied, what the rest hold is lost
+  if (auto *MI = dyn_cast<MemTransferInst>(CB)) {
+    unsigned tmp = newNode();
+    addComplex(getValueNode(MI->getRawSource()), Complex::Load, tmp);
+    addComplex(getValueNode(MI->getRawDest()), Complex::Store, tmp);
+    return;
+  }
+  if (isa<IntrinsicInst>(CB))
+    return;
+
+  // the arguments of an allocation wrapper are still passed on, the
+  // cache pointer among them
+  unsigned ret = getValueNode(CB);
+  if (ret != None && isHeapAlloc(CB)) {
+    unsigned obj = getObjectNode(CB);
+    Nodes[ret].pts.set(obj);
+    ret = None;
+  }
+
+  std::vector<unsigned> args;
+  for (Value *arg : CB->args())
+    args.push_back(getValueNode(arg));
+
+  Value *Callee = CB->getCalledOperand()->stripPointerCasts();
+  if (auto *F = dyn_cast<Function>(Callee)) {
+    F = cast<Function>(const_cast<Value *>(getDefinition(F)));
+    // an external function is assumed to keep its pointers to itself
+    if (!F->isDeclaration())
+      linkCall(F, args, ret);
+    return;
+  }
+
+  unsigned callee = getValueNode(Callee);
+  if (callee == None)
+    return;
+  CallSites.push_back(CallSite{args, ret, PtsSet()});
+  if (auto *CI = dyn_cast<CallInst>(CB))
+    IndirectCalls[CI] = CallSites.size() - 1;
+  addComplex(callee, Complex::Call, CallSites.size() - 1);
+}
+
+bool Andersen::linkCall(const Function *F, const std::vector<unsigned> &args,
+                        unsigned ret) {
+  bool changed = false;
+  unsigned i = 0;
+  for (const Argument &A : F->args()) {
+    if (i >= args.size())
+      break;
+    if (args[i] != None)
+      changed |= addEdge(args[i], getValueNode(&A));
+    ++i;
+  }
+  if (ret != None && F->getReturnType()->isPointerTy())
+    changed |= addEdge(getReturnNode(F), ret);
+  return changed;
+}
+
+bool Andersen::addEdge(unsigned from, unsigned to) {
+  if (from == None || to == None)
+    return false;
+  from = find(from);
+  to = find(to);
+  if (from == to || !Nodes[from].copyTo.test_and_set(to))
+    return false;
+  return Nodes[to].pts |= Nodes[from].pts;
+}
+
+// iterative Tarjan over the copy edges between representatives, and the
+// offset constraints if withOffsets. visit gets the root and members of
+// every strongly connected component, in reverse topological order
+void Andersen::forEachSCC(
+    bool withOffsets,
+    const std::function<void(unsigned, const std::vector<unsigned> &)>
+        &visit) {
+  struct Frame {
+    unsigned n;
+    std::vector<unsigned> succs;
+    size_t next;
+  };
+
+  unsigned N = Nodes.size();
+  std::vector<unsigned> index(N, None), low(N, 0);
+  std::vector<bool> onStack(N, false);
+  std::vector<unsigned> stack, members;
+  std::vector<Frame> frames;
+  unsigned counter = 0;
+
+  auto enter = [&](unsigned n) {
+    index[n] = low[n] = counter++;
+    stack.push_back(n);
+    onStack[n] = true;
+    frames.push_back(Frame{n, {}, 0});
+    for (unsigned s : Nodes[n].copyTo) {
+      unsigned r = find(s);
+      if (r != n)
+        frames.back().succs.push_back(r);
+    }
+    if (!withOffsets)
+      return;
+    for (const Complex &C : Nodes[n].complex) {
+      unsigned r = C.kind == Complex::Offset ? find(C.other) : n;
+      if (r != n)
+        frames.back().succs.push_back(r);
+    }
+  };
+
+  for (unsigned root = 0; root < N; ++root) {
+    if (find(root) != root || index[root] != None)
+      continue;
+    enter(root);
+    while (!frames.empty()) {
+      Frame &F = frames.back();
+      if (F.next < F.succs.size()) {
+        unsigned n = F.n, s = F.succs[F.next++];
+        if (index[s] == None)
+          enter(s);
+        else if (onStack[s])
+          low[n] = std::min(low[n], index[s]);
+        continue;
+      }
+
+      unsigned n = F.n;
+      frames.pop_back();
+      if (!frames.empty())
+        low[frames.back().n] = std::min(low[frames.back().n], low[n]);
+      if (low[n] != index[n])
+        continue;
+      members.clear();
+      unsigned m;
+      do {
+        m = stack.back();
+        stack.pop_back();
+        onStack[m] = false;
+        members.push_back(m);
+      } while (m != n);
+      visit(n, members);
+    }
+  }
+}
+
+void Andersen::collapseCycles(std::vector<unsigned> &order) {
+  order.clear();
+  forEachSCC(false, [&](unsigned root, const std::vector<unsigned> &scc) {
+    for (unsigned m : scc) {
+      if (m != root)
+        unite(root, m);
+    }
+    order.push_back(root);
+  });
+  std::reverse(order.begin(), order.end());
+}
+
+void Andersen::findOffsetCycles() {
+  OffsetCycle.assign(Nodes.size(), None);
+  forEachSCC(true, [&](unsigned root, const std::vector<unsigned> &scc) {
+    for (unsigned m : scc)
+      OffsetCycle[m] = root;
+  });
+}
+
+// the complex constraints on n, for the objects new to it since the last
+// wave. returns whether a points-to set grew
+bool Andersen::applyComplex(unsigned n) {
+  PtsSet delta;
+  delta.intersectWithComplement(Nodes[n].pts, Nodes[n].processed);
+  if (delta.empty())
+    return false;
+  Nodes[n].processed |= delta;
+
+  bool changed = false;
+  // nodes are created on the way, keep nothing pointing into them
+  std::vector<Complex> complex = Nodes[n].complex;
+  for (const Complex &C : complex) {
+    for (unsigned o : delta) {
+      switch (C.kind) {
+      case Complex::Load:
+        changed |= addEdge(getFieldNode(o, C.offset), C.other);
+        break;
+      case Complex::Store:
+        changed |= addEdge(C.other, getFieldNode(o, C.offset));
+        break;
+      case Complex::Offset: {
+        // on a cycle the offsets would add up to MaxOffset, one field at a
+        // time, the fields fold into the object instead
+        unsigned to = find(C.other);
+        bool cycle = C.offset > 0 && n < OffsetCycle.size() &&
+                     to < OffsetCycle.size() &&
+                     OffsetCycle[to] == OffsetCycle[n];
+        unsigned field = cycle ? Nodes[o].base : getFieldNode(o, C.offset);
+        changed |= Nodes[to].pts.test_and_set(field);
+        break;
+      }
+      case Complex::Call: {
+        auto *F = dyn_cast_or_null<Function>(Nodes[o].obj);
+        if (!F || CallSites[C.other].linked.test(o))
+          break;
+        CallSites[C.other].linked.set(o);
+        if (!F->isDeclaration()) {
+          CallSite CS = CallSites[C.other];
+          changed |= linkCall(F, CS.args, CS.ret);
+        }
+        break;
+      }
+      }
+    }
+  }
+  return changed;
+}
+
+void Andersen::solve() {
+  for (Module *M : Modules) {
+    DL = &M->getDataLayout();
+    for (GlobalVariable &G : M->globals()) {
+      if (G.hasInitializer())
+        addInitializer(getObjectNode(&G), G.getInitializer(), 0);
+    }
+    for (Function &F : *M) {
+      if (!F.isDeclaration())
+        addFunction(&F);
+    }
+  }
+
+  std::vector<unsigned> order;
+  bool changed = true;
+  while (changed) {
+    ++Waves;
+    collapseCycles(order);
+    findOffsetCycles();
+    for (unsigned n : order) {
+      PtsSet delta;
+      delta.intersectWithComplement(Nodes[n].pts, Nodes[n].propagated);
+      if (delta.empty())
+        continue;
+      Nodes[n].propagated |= delta;
+      for (unsigned s : Nodes[n].copyTo) {
+        unsigned r = find(s);
+        if (r != n)
+          Nodes[r].pts |= delta;
+      }
+    }
+
+    changed = false;
+    for (unsigned n = 0; n < Nodes.size(); ++n) {
+      if (find(n) == n && !Nodes[n].complex.empty())
+        changed |= applyComplex(n);
+    }
+  }
+}
+
+void Andersen::getPointees(const Value *V, std::vector<Pointee> &out) const {
+  auto itr = ValueNodes.find(getDefinition(V));
+  if (itr == ValueNodes.end() || itr->second == None)
+    return;
+  for (unsigned o : Nodes[findConst(itr->second)].pts)
+    out.push_back(Pointee(Nodes[Nodes[o].base].obj, Nodes[o].offset));
+}
+
+void Andersen::getCallees(const CallInst *CI,
+                          std::vector<Function *> &out) const {
+  auto itr = IndirectCalls.find(CI);
+  if (itr == IndirectCalls.end())
+    return;
+  for (unsigned o : CallSites[itr->second].linked) {
+    auto *F = cast<Function>(Nodes[o].obj);
+    out.push_back(const_cast<Function *>(F));
+  }
+}
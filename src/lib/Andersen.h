@@ -0,0 +1,145 @@
+#ifndef _ANDERSEN_H
+#define _ANDERSEN_H
+
+#include <llvm/ADT/DenseMap.h>
+#include <llvm/ADT/SparseBitVector.h>
+#include <llvm/ADT/StringMap.h>
+#include <llvm/IR/Instructions.h>
+#include <llvm/IR/Module.h>
+#include <llvm/IR/Operator.h>
+
+#include <functional>
+#include <vector>
+
+// Whole-program, field-sensitive Andersen points-to analysis over the
+// loaded modules. Objects are globals, functions, allocas and the calls
+// returning heap memory, each split into fields by byte offset; array
+// elements are not told apart. Declarations are linked to the definitions
+// of the same name in other modules.
+//
+// The constraints are solved by wave propagation: every wave collapses
+// the cycles of the copy graph, pushes the new part of each points-to set
+// along it in topological order, then applies the loads, stores, field
+// offsets and indirect calls to what is new since the last wave. The
+// sets are SparseBitVectors of node ids.
+class Andersen {
+public:
+  typedef llvm::SparseBitVector<> PtsSet;
+  typedef std::pair<const llvm::Value *, int64_t> Pointee;
+  // whether the call returns a new heap object
+  typedef std::function<bool(llvm::CallBase *)> HeapPredicate;
+
+  static const unsigned None = ~0U;
+  // fields past this offset fold into the object's first one
+  static const int64_t MaxOffset = 1 << 16;
+
+  explicit Andersen(HeapPredicate isHeapAlloc_)
+      : isHeapAlloc(isHeapAlloc_) {}
+
+  // definitions are linked by name, so add every module before any
+  // constraint is generated
+  void addModule(llvm::Module *M);
+  void solve();
+
+  // the objects V may point to, each a global, function, alloca or heap
+  // allocating call, with the byte offset into it
+  void getPointees(const llvm::Value *V, std::vector<Pointee> &out) const;
+  // the functions an indirect call may call, none if unknown
+  void getCallees(const llvm::CallInst *CI,
+                  std::vector<llvm::Function *> &out) const;
+
+  size_t numNodes() const { return Nodes.size(); }
+  size_t numObjects() const { return NumObjects; }
+  unsigned numWaves() const { return Waves; }
+  unsigned numCollapsed() const { return Collapsed; }
+
+private:
+  struct Complex {
+    enum Kind { Load, Store, Offset, Call } kind;
+    // the loaded to, stored or offset node, or the indirect call
+    unsigned other;
+    int64_t offset;
+  };
+
+  struct Node {
+    PtsSet pts;
+    // the part of pts pushed along the copy edges / through the complex
+    // constraints already
+    PtsSet propagated;
+    PtsSet processed;
+    PtsSet copyTo;
+    std::vector<Complex> complex;
+    unsigned rep;
+    // fields of one object share its first node as base
+    unsigned base = None;
+    int64_t offset = 0;
+    // the value of an object's first node
+    const llvm::Value *obj = nullptr;
+  };
+
+  // an indirect call, its arguments and result
+  struct CallSite {
+    std::vector<unsigned> args;
+    unsigned ret;
+    // the function objects linked to it
+    PtsSet linked;
+  };
+
+  unsigned newNode();
+  unsigned find(unsigned n);
+  unsigned findConst(unsigned n) const;
+  void unite(unsigned a, unsigned b);
+
+  unsigned getValueNode(const llvm::Value *V);
+  unsigned getObjectNode(const llvm::Value *V);
+  unsigned getFieldNode(unsigned obj, int64_t offset);
+  unsigned getReturnNode(const llvm::Function *F);
+  const llvm::Value *getDefinition(const llvm::Value *V) const;
+  int64_t getGEPOffset(const llvm::GEPOperator *GEP);
+
+  void addCopy(unsigned from, unsigned to);
+  void addOffset(unsigned from, unsigned to, int64_t offset);
+  void addComplex(unsigned n, Complex::Kind kind, unsigned other,
+                  int64_t offset = 0);
+  void addInitializer(unsigned obj, const llvm::Constant *C, int64_t offset);
+  void addFunction(llvm::Function *F);
+  void addInstruction(llvm::Instruction *I);
+  void addCall(llvm::CallBase *CB);
+  // returns whether a points-to set grew
+  bool linkCall(const llvm::Function *F, const std::vector<unsigned> &args,
+                unsigned ret);
+
+  // new edges during a wave carry the whole set at once
+  bool addEdge(unsigned from, unsigned to);
+  void forEachSCC(
+      bool withOffsets,
+      const std::function<void(unsigned, const std::vector<unsigned> &)>
+          &visit);
+  // one Tarjan pass, returns the nodes in topological order
+  void collapseCycles(std::vector<unsigned> &order);
+  // the cycles through positive offsets, by the copy edges as they are now
+  void findOffsetCycles();
+  bool applyComplex(unsigned n);
+
+  HeapPredicate isHeapAlloc;
+  std::vector<llvm::Module *> Modules;
+  const llvm::DataLayout *DL = nullptr;
+
+  std::vector<Node> Nodes;
+  llvm::DenseMap<const llvm::Value *, unsigned> ValueNodes;
+  llvm::DenseMap<const llvm::Value *, unsigned> ObjectNodes;
+  llvm::DenseMap<std::pair<unsigned, int64_t>, unsigned> Fields;
+  llvm::DenseMap<const llvm::Function *, unsigned> ReturnNodes;
+  // externally visible definitions by name
+  llvm::StringMap<const llvm::GlobalValue *> Definitions;
+  std::vector<CallSite> CallSites;
+  llvm::DenseMap<const llvm::CallInst *, unsigned> IndirectCalls;
+  // the component of each representative along copy and offset edges
+  std::vector<unsigned> OffsetCycle;
+
+  size_t NumObjects = 0;
+  unsigned Waves = 0;
+  unsigned Collapsed = 0;
+};
+
+#endif
@@ -13,6 +13,7 @@
 #include <llvm/Analysis/ValueTracking.h>
 #include <llvm/IR/Constants.h>
 #include <llvm/IR/InstIterator.h>
+#include <llvm/IR/InstVisitor.h>
 #include <llvm/IR/Instructions.h>
 #include <llvm/IR/IntrinsicInst.h>
 #include <llvm/IR/Metadata.h>
@@ -24,6 +25,9 @@
 
 #include "Annotation.h"
 #include "Common.h"
+#include "FuncHash.h"
+#include "SummaryCache.h"
+#include "ThreadPool.h"
 
 using namespace llvm;
 
@@ -187,8 +191,9 @@ bool isAllocFn(StringRef name, int *size, int *flag) {
     return true;
   }
 
-  // mempool
-  // XXX needs special care
+  // mempool, not an allocation of its own here: StructAnalyzer takes it
+  // as a pool_alloc site and CacheInventory resolves the pool to the
+  // cache it was created on (getAllocSiteDest)
   if (!name.compare("mempool_alloc")) {
     *size = -1;
     *flag = 1;
@@ -245,6 +250,104 @@ std::string getLoadId(LoadInst *LI) {
   return Anno;
 }
 
+// ids of a body annotated in an earlier run
+static bool replayIds(const FuncSummary &S,
+                      const std::vector<Instruction *> &Insts,
+                      std::vector<std::pair<Instruction *, std::string>> &buf) {
+  size_t first = buf.size();
+  for (auto &item : S.Ids) {
+    if (item.first >= Insts.size() ||
+        !(isa<LoadInst>(Insts[item.first]) ||
+          isa<StoreInst>(Insts[item.first]))) {
+      buf.resize(first);
+      return false;
+    }
+    buf.push_back(std::make_pair(Insts[item.first], item.second));
+  }
+  return true;
+}
+
+// Attach ids to the loads and stores the call graph will ask about. The ids
+// only read IR and are computed per function on the pool, the metadata is
+// attached afterwards since the module's context is not thread-safe.
+void annotateModule(Module *M, WorkStealingPool *Pool,
+                    SummaryCache *Summaries,
+                    const DenseMap<Function *, size_t> &Hashes) {
+  typedef std::vector<std::pair<Instruction *, std::string>> AnnoBuffer;
+
+  std::vector<Function *> Funcs;
+  for (Function &F : *M) {
+    if (!F.empty())
+      Funcs.push_back(&F);
+  }
+
+  unsigned workers = Pool ? Pool->size() : 1;
+  std::vector<AnnoBuffer> buffers(workers);
+  auto annotate = [&](size_t i, unsigned worker) {
+    FuncSummary *S = getSummary(Summaries, Hashes, Funcs[i]);
+    std::vector<Instruction *> Insts;
+    // the ids name locals, the module and alloc call locations, none of
+    // which the body hash covers
+    uint64_t Key = 0;
+    if (S) {
+      getSummaryInsts(Funcs[i], Insts);
+      Key = hashFunctionNames(Funcs[i]);
+      if (S->HasIds && S->IdsKey == Key &&
+          replayIds(*S, Insts, buffers[worker]))
+        return;
+    }
+
+    size_t first = buffers[worker].size();
+    for (inst_iterator it = inst_begin(Funcs[i]), ie = inst_end(Funcs[i]);
+         it != ie; ++it) {
+      Instruction *I = &*it;
+      Value *V = nullptr;
+      if (LoadInst *LI = dyn_cast<LoadInst>(I)) {
+        if (isFunctionPointerOrVoid(LI->getType()))
+          V = LI->getPointerOperand();
+      } else if (StoreInst *SI = dyn_cast<StoreInst>(I)) {
+        if (isFunctionPointerOrVoid(SI->getValueOperand()->getType()))
+          V = SI->getPointerOperand();
+      }
+      if (!V || I->getMetadata(MD_ID))
+        continue;
+
+      std::string Anno = getAnnotation(V, M);
+      if (!Anno.empty())
+        buffers[worker].push_back(std::make_pair(I, Anno));
+    }
+
+    if (S) {
+      DenseMap<Instruction *, unsigned> Ords;
+      for (unsigned n = 0; n < Insts.size(); ++n)
+        Ords[Insts[n]] = n;
+      S->Ids.clear();
+      for (size_t n = first; n < buffers[worker].size(); ++n) {
+        auto &item = buffers[worker][n];
+        S->Ids.push_back(std::make_pair(Ords[item.first], item.second));
+      }
+      S->HasIds = true;
+      S->IdsKey = Key;
+      S->Dirty = true;
+    }
+  };
+
+  if (Pool) {
+    Pool->parallelFor(Funcs.size(), annotate);
+  } else {
+    for (size_t i = 0; i < Funcs.size(); ++i)
+      annotate(i, 0);
+  }
+
+  LLVMContext &VMCtx = M->getContext();
+  for (auto &buf : buffers) {
+    for (auto &item : buf) {
+      MDNode *MD = MDNode::get(VMCtx, MDString::get(VMCtx, item.second));
+      item.first->setMetadata(MD_ID, MD);
+    }
+  }
+}
+
 std::string getStructId(Value *PVal, User::op_iterator &IS,
                         User::op_iterator &IE, Module *M, bool debug) {
   if (debug)
@@ -302,7 +405,7 @@ std::string getStructId(Value *PVal, User::op_iterator &IS,
     std::string out;
     raw_string_ostream rso(out);
 
-    std::string structName = STy->getStructName().str();
+    std::string structName = getStructName(STy).str();
     if (structName.find("struct.anon") == 0) {
       structName = getScopeName(STy, M);
       structName = getAnonStructId(PVal, M, structName);
@@ -411,8 +514,8 @@ std::string getAnonStructId(Value *V, Module *M, StringRef Prefix) {
 		while (Ty->isPointerTy())
 			Ty = Ty->getContainedType(0);
 		if (StructType *STy = dyn_cast<StructType>(Ty)) {
-			if (!STy->getStructName().startswith("struct.anon")) {
-				return STy->getStructName();
+			if (!getStructName(STy).startswith("struct.anon")) {
+				return getStructName(STy);
 			}
 		}
 #endif
@@ -424,139 +527,148 @@ std::string getAnonStructId(Value *V, Module *M, StringRef Prefix) {
   return Prefix.str();
 }
 
-std::string getAnnotation(Value *V, Module *M) {
-  bool debug = false;
+namespace {
 
-  SmallPtrSet<Value *, 16> Visited;
-  SmallVector<Value *, 8> WorkList;
+// one step of the annotation walk over an instruction: either settles the
+// id or queues the values the pointer derives from
+class AnnotationStep : public InstVisitor<AnnotationStep, bool> {
+public:
+  AnnotationStep(Module *M_, SmallPtrSetImpl<Value *> &Visited_,
+                 SmallVectorImpl<Value *> &WorkList_)
+      : M(M_), Visited(Visited_), WorkList(WorkList_) {}
 
-  Visited.insert(V);
-  WorkList.push_back(V);
+  void push(Value *V) {
+    if (Visited.insert(V).second)
+      WorkList.push_back(V);
+  }
 
-  while (!WorkList.empty()) {
-    Value *v = WorkList.pop_back_val();
+  // id is in the form of struct.[name].[offset]
+  bool visitGEP(Value *PVal, User::op_iterator is, User::op_iterator ie) {
+    std::string structId = getStructId(PVal, is, ie, M, Debug);
+    if (!structId.empty()) {
+      Id = structId;
+      return true;
+    }
+    push(PVal);
+    return false;
+  }
 
-    if (GlobalVariable *GV = dyn_cast<GlobalVariable>(v))
-      return getVarId(GV);
+  bool visitGetElementPtrInst(GetElementPtrInst &GEP) {
+    Function *f = GEP.getParent()->getParent();
+    if (f->getName().str() == "vfs_llseek" ||
+        f->getName().str() == "do_iter_readv_writev") {
+      GEP.print(errs());
+      fprintf(stderr, "\n");
+      Debug = true;
+    }
+    return visitGEP(GEP.getPointerOperand(), GEP.idx_begin(),
+                    GEP.idx_end() - 1);
+  }
 
-    if (Argument *A = dyn_cast<Argument>(v))
-      return getArgId(A);
+  bool visitAllocaInst(AllocaInst &AI) {
+    Id = getVarId(&AI);
+    return true;
+  }
 
-    User::op_iterator is, ie; // GEP indices
-    Value *PVal = NULL;       // Pointer operand in the GEP
-    if (GetElementPtrInst *GEP = dyn_cast<GetElementPtrInst>(v)) {
-      // GEP instruction
-      is = GEP->idx_begin();
-      ie = GEP->idx_end() - 1;
-      PVal = GEP->getPointerOperand();
-      Function *f = GEP->getParent()->getParent();
-      if (f->getName().str() == "vfs_llseek" ||
-          f->getName().str() == "do_iter_readv_writev") {
-        v->print(errs());
-        fprintf(stderr, "\n");
-        debug = true;
-      }
-    } else if (ConstantExpr *CE = dyn_cast<ConstantExpr>(v)) {
-      // constant GEP expression
-      if (CE->getOpcode() == Instruction::GetElementPtr) {
-        is = CE->op_begin() + 1;
-        ie = CE->op_end() - 1;
-        PVal = CE->getOperand(0);
-      } else if (CE->isCast()) {
-        if (Visited.insert(CE->getOperand(0)).second)
-          WorkList.push_back(CE->getOperand(0));
-        continue;
-      }
-    }
+  bool visitCastInst(CastInst &CI) {
+    push(CI.getOperand(0));
+    return false;
+  }
 
-    // id is in the form of struct.[name].[offset]
-    if (PVal) {
-      std::string structId = getStructId(PVal, is, ie, M, debug);
-      if (!structId.empty()) {
-        return structId;
-      } else {
-        if (Visited.insert(PVal).second)
-          WorkList.push_back(PVal);
-        // Instruction *i = cast<Instruction>(v);
-        // Function *f = i->getParent()->getParent();
-        // errs() << "Unsupported GEP: " << f->getName() << "::" << *i << "\n";
-        // errs() << "\t Pointer: " << *PVal << "\n";
-        continue;
-      }
+  bool visitCallInst(CallInst &CI) {
+    Value *CV = CI.getCalledOperand();
+    // handle simple cast expr
+    if (ConstantExpr *CE = dyn_cast<ConstantExpr>(CV)) {
+      if (CE->isCast())
+        CV = CE->getOperand(0);
     }
-
-    if (AllocaInst *AI = dyn_cast<AllocaInst>(v)) {
-      return getVarId(AI);
+    Function *F = dyn_cast<Function>(CV);
+    if (!F)
+      return false;
+
+    // check for alloc function
+    if (isAllocFn(F->getName())) {
+      // return the loc
+      raw_string_ostream rso(Id);
+      CI.getDebugLoc().print(rso);
+      rso.flush();
+    } else {
+      Id = getRetId(F);
     }
+    return true;
+  }
 
-    if (CastInst *CI = dyn_cast<CastInst>(v)) {
-      if (Visited.insert(CI->getOperand(0)).second)
-        WorkList.push_back(CI->getOperand(0));
-      continue;
-    }
+  bool visitLoadInst(LoadInst &LI) {
+    push(LI.getPointerOperand());
+    return false;
+  }
 
-    if (CallInst *CI = dyn_cast<CallInst>(v)) {
-      Value *CV = CI->getCalledFunction();
-      // handle simple cast expr
-      if (ConstantExpr *CE = dyn_cast<ConstantExpr>(CV)) {
-        if (CE->isCast())
-          CV = CE->getOperand(0);
-      }
-      Function *F = dyn_cast<Function>(CV);
-      if (F != NULL) {
-        // check for alloc function
-        StringRef name = F->getName();
-        if (isAllocFn(name)) {
-          // return the loc
-          std::string loc;
-          raw_string_ostream rso(loc);
-          const DebugLoc &LOC = CI->getDebugLoc();
-          LOC.print(rso);
-          return rso.str();
-        } else
-          return getRetId(F);
-      }
-    }
+  bool visitPHINode(PHINode &PHI) {
+    for (unsigned i = 0, e = PHI.getNumIncomingValues(); i < e; ++i)
+      push(PHI.getIncomingValue(i));
+    return false;
+  }
 
-    if (LoadInst *LI = dyn_cast<LoadInst>(v)) {
-      Value *S = LI->getPointerOperand();
-      if (Visited.insert(S).second)
-        WorkList.push_back(S);
-      continue;
-    }
+  bool visitSelectInst(SelectInst &SEI) {
+    push(SEI.getTrueValue());
+    push(SEI.getFalseValue());
+    return false;
+  }
 
-    if (PHINode *PHI = dyn_cast<PHINode>(v)) {
-      for (unsigned i = 0, e = PHI->getNumIncomingValues(); i < e; ++i) {
-        if (Visited.insert(PHI->getIncomingValue(i)).second)
-          WorkList.push_back(PHI->getIncomingValue(i));
-      }
-      continue;
-    }
+  bool visitBinaryOperator(BinaryOperator &BO) {
+    // only when one of the operand is a constant int
+    if (isa<ConstantInt>(BO.getOperand(1)))
+      push(BO.getOperand(0));
+    else if (isa<ConstantInt>(BO.getOperand(0)))
+      push(BO.getOperand(1));
+    return false;
+  }
+
+  // WARNING("Unsupported annotation source: " << I << "\n");
+  bool visitInstruction(Instruction &I) { return false; }
+
+  std::string Id;
 
-    if (SelectInst *SEI = dyn_cast<SelectInst>(v)) {
-      if (Visited.insert(SEI->getTrueValue()).second)
-        WorkList.push_back(SEI->getTrueValue());
-      if (Visited.insert(SEI->getFalseValue()).second)
-        WorkList.push_back(SEI->getFalseValue());
+private:
+  Module *M;
+  SmallPtrSetImpl<Value *> &Visited;
+  SmallVectorImpl<Value *> &WorkList;
+  bool Debug = false;
+};
+
+} // namespace
+
+std::string getAnnotation(Value *V, Module *M) {
+  SmallPtrSet<Value *, 16> Visited;
+  SmallVector<Value *, 8> WorkList;
+  AnnotationStep Step(M, Visited, WorkList);
+
+  Step.push(V);
+  while (!WorkList.empty()) {
+    Value *v = WorkList.pop_back_val();
+
+    if (Instruction *I = dyn_cast<Instruction>(v)) {
+      if (Step.visit(I))
+        return Step.Id;
       continue;
     }
 
-    if (BinaryOperator *BO = dyn_cast<BinaryOperator>(v)) {
-      // only when one of the operand is a constant int
-      if (isa<ConstantInt>(BO->getOperand(1))) {
-        if (Visited.insert(BO->getOperand(0)).second)
-          WorkList.push_back(BO->getOperand(0));
-        continue;
-      }
+    if (GlobalVariable *GV = dyn_cast<GlobalVariable>(v))
+      return getVarId(GV);
 
-      if (isa<ConstantInt>(BO->getOperand(0))) {
-        if (Visited.insert(BO->getOperand(1)).second)
-          WorkList.push_back(BO->getOperand(1));
-        continue;
+    if (Argument *A = dyn_cast<Argument>(v))
+      return getArgId(A);
+
+    if (ConstantExpr *CE = dyn_cast<ConstantExpr>(v)) {
+      // constant GEP expression
+      if (CE->getOpcode() == Instruction::GetElementPtr) {
+        if (Step.visitGEP(CE->getOperand(0), CE->op_begin() + 1,
+                          CE->op_end() - 1))
+          return Step.Id;
+      } else if (CE->isCast()) {
+        Step.push(CE->getOperand(0));
       }
     }
-
-    // WARNING("Unsupported annotation source: " << *v << "\n");
   }
   return std::string();
 }
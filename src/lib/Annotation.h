@@ -3,6 +3,7 @@
 
 #pragma once
 
+#include <llvm/ADT/DenseMap.h>
 #include <llvm/IR/Instructions.h>
 #include <llvm/IR/IntrinsicInst.h>
 #include <llvm/IR/Metadata.h>
@@ -13,6 +14,7 @@
 #include <llvm/Support/Path.h>
 #include <string>
 
+#include "CanonicalTypes.h"
 #include "Common.h"
 
 #define MD_TaintSrc "taint_src"
@@ -76,12 +78,18 @@ static inline std::string getScopeName(const llvm::Instruction *I) {
   return "_" + moduleName.str() + "." + F->getName().str() + ".anonymous";
 }
 
+// the name Ty has in its module, also when the module shares its
+// LLVMContext and the struct got renamed there
+static inline llvm::StringRef getStructName(const llvm::StructType *Ty) {
+  return CanonicalTypes::getName(Ty);
+}
+
 // prefix anonymous struct name with module name
 static inline std::string getScopeName(const llvm::StructType *Ty,
                                        const llvm::Module *M) {
   if (Ty->isLiteral())
     return "";
-  llvm::StringRef structName = Ty->getStructName();
+  llvm::StringRef structName = getStructName(Ty);
   size_t dotPos = structName.rfind('.');
   if (M && (structName.startswith("struct.anon") ||
             structName.startswith("union.anon"))) {
@@ -144,7 +152,7 @@ static inline std::string getRetId(llvm::CallInst *CI) {
   if (llvm::Function *CF = CI->getCalledFunction())
     return getRetId(CF);
   else {
-    std::string sID = getValueId(CI->getCalledFunction());
+    std::string sID = getValueId(CI->getCalledOperand());
     if (sID != "")
       return "ret." + sID;
   }
@@ -178,7 +186,13 @@ static inline bool isAllocFn(llvm::StringRef name) {
   return isAllocFn(name, &size, &flag);
 }
 
+class WorkStealingPool;
+class SummaryCache;
 extern std::string getAnnotation(llvm::Value *V, llvm::Module *M);
+extern void
+annotateModule(llvm::Module *M, WorkStealingPool *Pool,
+               SummaryCache *Summaries,
+               const llvm::DenseMap<llvm::Function *, size_t> &Hashes);
 extern std::string getLoadId(llvm::LoadInst *LI);
 extern std::string getStoreId(llvm::StoreInst *SI);
 extern std::string getAnonStructId(llvm::Value *V, llvm::Module *M,
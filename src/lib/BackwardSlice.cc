@@ -0,0 +1,200 @@
+/*
+ * Backward slices of allocator arguments
+ *
+ * For licensing details see LICENSE
+ */
+
+#include <llvm/IR/IntrinsicInst.h>
+
+#include "BackwardSlice.h"
+
+using namespace llvm;
+
+BackwardSlicer::Sources BackwardSlicer::getSources(Value *V) {
+  auto itr = Memo.find(V);
+  if (itr != Memo.end())
+    return itr->second;
+
+  Sources out;
+  collect(V, 0, out);
+  // the top-level value is memoized even when cut short, asking again
+  // would stop at the same point
+  Memo[V] = out;
+  return out;
+}
+
+Value *BackwardSlicer::getSource(Value *V) {
+  Sources sources = getSources(V);
+  return sources.size() == 1 ? sources.front() : nullptr;
+}
+
+LoadInst *BackwardSlicer::getSourceLoad(Value *V) {
+  Sources sources = getSources(V);
+  LoadInst *first = nullptr;
+  for (Value *src : sources) {
+    auto *LI = dyn_cast<LoadInst>(src);
+    if (!LI)
+      return nullptr;
+    if (!first)
+      first = LI;
+    else if (LI->getPointerOperand()->stripPointerCasts() !=
+             first->getPointerOperand()->stripPointerCasts())
+      return nullptr;
+  }
+  return first;
+}
+
+Constant *BackwardSlicer::getSourceConstant(Value *V) {
+  Sources sources = getSources(V);
+  Constant *first = nullptr;
+  for (Value *src : sources) {
+    auto *C = dyn_cast<Constant>(src);
+    // constants are uniqued, the same value is the same pointer
+    if (!C || (first && C != first))
+      return nullptr;
+    first = C;
+  }
+  return first;
+}
+
+// nothing but loads from it and stores to it, so the stores are all that
+// can reach a load
+bool BackwardSlicer::isStackSlot(AllocaInst *AI) {
+  auto itr = Slots.find(AI);
+  if (itr != Slots.end())
+    return itr->second;
+
+  bool slot = true;
+  SmallVector<Value *, 4> worklist{AI};
+  while (slot && !worklist.empty()) {
+    Value *P = worklist.pop_back_val();
+    for (User *U : P->users()) {
+      if (isa<LoadInst>(U) || isa<DbgInfoIntrinsic>(U))
+        continue;
+      if (auto *SI = dyn_cast<StoreInst>(U)) {
+        if (SI->getValueOperand() == P)
+          slot = false;
+        continue;
+      }
+      if (auto *II = dyn_cast<IntrinsicInst>(U)) {
+        if (II->isLifetimeStartOrEnd())
+          continue;
+      }
+      if (isa<BitCastInst>(U)) {
+        worklist.push_back(U);
+        continue;
+      }
+      slot = false;
+      break;
+    }
+  }
+  Slots[AI] = slot;
+  return slot;
+}
+
+Value *BackwardSlicer::getStoredValue(LoadInst *LI) {
+  if (!AA || !LI->getType()->isPointerTy())
+    return nullptr;
+
+  AAResults &AAR = AA->get(LI->getFunction());
+  MemoryLocation Loc = MemoryLocation::get(LI);
+  BasicBlock *BB = LI->getParent();
+  SmallPtrSet<BasicBlock *, 8> seen{BB};
+  Instruction *I = LI;
+  for (unsigned scanned = 0; scanned < MaxScan; ++scanned) {
+    if (I == &BB->front()) {
+      BB = BB->getSinglePredecessor();
+      if (!BB || !seen.insert(BB).second)
+        return nullptr;
+      I = BB->getTerminator();
+    } else {
+      I = I->getPrevNode();
+    }
+
+    if (auto *SI = dyn_cast<StoreInst>(I)) {
+      AliasResult R = AAR.alias(MemoryLocation::get(SI), Loc);
+      if (R == AliasResult::MustAlias &&
+          SI->getValueOperand()->getType()->isPointerTy())
+        return SI->getValueOperand();
+      if (R != AliasResult::NoAlias)
+        return nullptr;
+    } else if (isModSet(AAR.getModRefInfo(I, Loc))) {
+      return nullptr;
+    }
+  }
+  return nullptr;
+}
+
+bool BackwardSlicer::collect(Value *V, unsigned depth, Sources &out) {
+  auto itr = Memo.find(V);
+  if (itr != Memo.end()) {
+    out.append(itr->second.begin(), itr->second.end());
+    return true;
+  }
+  if (depth > MaxDepth) {
+    out.push_back(V);
+    return false;
+  }
+  if (!Active.insert(V).second)
+    return false;
+
+  Sources local;
+  bool complete = true;
+  if (auto *CI = dyn_cast<CastInst>(V)) {
+    complete = collect(CI->getOperand(0), depth + 1, local);
+  } else if (auto *PN = dyn_cast<PHINode>(V)) {
+    for (Value *In : PN->incoming_values())
+      complete &= collect(In, depth + 1, local);
+  } else if (auto *SI = dyn_cast<SelectInst>(V)) {
+    complete &= collect(SI->getTrueValue(), depth + 1, local);
+    complete &= collect(SI->getFalseValue(), depth + 1, local);
+  } else if (auto *LI = dyn_cast<LoadInst>(V)) {
+    Value *Ptr = LI->getPointerOperand()->stripPointerCasts();
+    auto *AI = dyn_cast<AllocaInst>(Ptr);
+    bool stored = false;
+    if (AI && isStackSlot(AI)) {
+      SmallVector<Value *, 4> worklist{AI};
+      while (!worklist.empty()) {
+        Value *P = worklist.pop_back_val();
+        for (User *U : P->users()) {
+          if (isa<BitCastInst>(U))
+            worklist.push_back(U);
+          else if (auto *Store = dyn_cast<StoreInst>(U)) {
+            complete &= collect(Store->getValueOperand(), depth + 1, local);
+            stored = true;
+          }
+        }
+      }
+    }
+    if (!stored) {
+      if (Value *SV = getStoredValue(LI)) {
+        complete &= collect(SV, depth + 1, local);
+        stored = true;
+      }
+    }
+    // never stored to, or not a slot
+    if (!stored)
+      local.push_back(V);
+  } else {
+    local.push_back(V);
+  }
+  Active.erase(V);
+
+  // dedup, keeping the order the sources were reached in
+  SmallPtrSet<Value *, 8> seen;
+  Sources unique;
+  for (Value *src : local) {
+    if (seen.insert(src).second)
+      unique.push_back(src);
+  }
+  if (unique.size() > MaxSources) {
+    unique.clear();
+    unique.push_back(V);
+  }
+
+  // a cycle only cuts the walk short for the values on it
+  if (complete)
+    Memo[V] = unique;
+  out.append(unique.begin(), unique.end());
+  return complete;
+}
@@ -0,0 +1,71 @@
+#ifndef _BACKWARD_SLICE_H
+#define _BACKWARD_SLICE_H
+
+#include <llvm/ADT/DenseMap.h>
+#include <llvm/ADT/SmallPtrSet.h>
+#include <llvm/ADT/SmallVector.h>
+#include <llvm/IR/Constants.h>
+#include <llvm/IR/Instructions.h>
+
+#include "FuncAACache.h"
+
+// Demand-driven backward slice of one value, through casts, phis, selects
+// and the stack slots unoptimized code spills to. The sources it ends in
+// are constants, globals, arguments, calls and loads from anywhere but a
+// stack slot; a value it can't follow further is its own source. A slot is
+// followed only if nothing but loads and stores use it, to every value
+// stored to it, regardless of order. Given an enabled FuncAACache, any
+// other load is followed to the store before it that must write what it
+// reads, in its block or up the chain of single predecessors, if nothing
+// in between may write there.
+//
+// Results are memoized per value, so an instance is meant to be reused for
+// the values of a function or module. Past MaxDepth steps the walk stops
+// and the value reached is a source. Not thread safe, workers keep one each.
+class BackwardSlicer {
+public:
+  typedef llvm::SmallVector<llvm::Value *, 4> Sources;
+
+  static const unsigned DefaultDepth = 16;
+  // more sources than this and the value is its own source
+  static const unsigned MaxSources = 16;
+
+  // instructions looked at going back from a load to its store
+  static const unsigned MaxScan = 64;
+
+  explicit BackwardSlicer(FuncAACache *AA_ = nullptr,
+                          unsigned MaxDepth_ = DefaultDepth)
+      : AA(AA_ && AA_->enabled() ? AA_ : nullptr), MaxDepth(MaxDepth_) {}
+
+  Sources getSources(llvm::Value *V);
+
+  // the only source of V, null if there are several
+  llvm::Value *getSource(llvm::Value *V);
+  // the load V comes from, null unless all of its sources load from the
+  // same location
+  llvm::LoadInst *getSourceLoad(llvm::Value *V);
+  // the constant V always is, null if it may be anything else
+  llvm::Constant *getSourceConstant(llvm::Value *V);
+
+  // forget what was memoized, before the bodies it was about go away
+  void clear() {
+    Memo.clear();
+    Slots.clear();
+  }
+
+private:
+  // false if out is cut short by the depth bound or a cycle, such results
+  // are not memoized
+  bool collect(llvm::Value *V, unsigned depth, Sources &out);
+  bool isStackSlot(llvm::AllocaInst *AI);
+  llvm::Value *getStoredValue(llvm::LoadInst *LI);
+
+  FuncAACache *AA;
+  unsigned MaxDepth;
+  llvm::DenseMap<llvm::Value *, Sources> Memo;
+  llvm::DenseMap<llvm::AllocaInst *, bool> Slots;
+  // on the current path, a phi reached again adds nothing
+  llvm::SmallPtrSet<llvm::Value *, 16> Active;
+};
+
+#endif
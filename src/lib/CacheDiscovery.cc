@@ -0,0 +1,747 @@
+/*
+ * Forward discovery of kmem_cache creation sites
+ *
+ * For licensing details see LICENSE
+ */
+
+#include <llvm/Analysis/ConstantFolding.h>
+#include <llvm/IR/Constants.h>
+#include <llvm/IR/DebugInfoMetadata.h>
+#include <llvm/IR/Instructions.h>
+#include <llvm/IR/Module.h>
+
+#include "Annotation.h"
+#include "BackwardSlice.h"
+#include "CacheDiscovery.h"
+
+using namespace llvm;
+
+// argument positions of the creation APIs, -1 when absent. KMEM_CACHE and
+// KMEM_CACHE_USERCOPY expand to the first two, or to the args variant on
+// kernels where align, ctor and the usercopy window moved into struct
+// kmem_cache_args. without a window argument the whitelist is empty
+struct CacheDiscoveryPass::CreateAPI {
+  const char *name;
+  int size, align, flags, ctor, useroffset, usersize;
+  bool argsStruct;
+};
+
+static const CacheDiscoveryPass::CreateAPI CreateAPIs[] = {
+    {"kmem_cache_create", 1, 2, 3, 4, -1, -1, false},
+    {"kmem_cache_create_usercopy", 1, 2, 3, 6, 4, 5, false},
+    {"__kmem_cache_create_args", 1, -1, 3, -1, -1, -1, true},
+};
+
+// mempool creation APIs: the argument with the pool, -1 when the pool is
+// returned, the one with the element allocator, -1 when implied by the API,
+// and the one with the cache or the kmalloc size
+struct CacheDiscoveryPass::PoolAPI {
+  const char *name;
+  int pool, allocFn, data;
+  bool slab;
+};
+
+static const CacheDiscoveryPass::PoolAPI PoolAPIs[] = {
+    {"mempool_create", -1, 1, 3, false},
+    {"mempool_create_node", -1, 1, 3, false},
+    {"mempool_init", 0, 2, 4, false},
+    {"mempool_create_slab_pool", -1, -1, 1, true},
+    {"mempool_init_slab_pool", 0, -1, 2, true},
+    {"mempool_create_kmalloc_pool", -1, -1, 1, false},
+    {"mempool_init_kmalloc_pool", 0, -1, 2, false},
+};
+
+// bio_set creation APIs: the argument with the bio_set, -1 when returned,
+// the front pad and the flags
+struct CacheDiscoveryPass::BiosetAPI {
+  const char *name;
+  int bioset, frontPad, flags;
+};
+
+static const CacheDiscoveryPass::BiosetAPI BiosetAPIs[] = {
+    {"bioset_init", 0, 2, 3},
+    {"bioset_create", -1, 1, 2},
+};
+
+// BIOSET_NEED_BVECS adds BIO_INLINE_VECS struct bio_vecs after the bio
+static const uint64_t BiosetNeedBvecs = 1;
+static const uint64_t BioInlineVecsSize = 4 * 16;
+
+// skb allocations whose data buffer comes from kmalloc_reserve, and the
+// argument with the size asked for. the inline ones are only called when
+// not inlined
+struct CacheDiscoveryPass::SkbAPI {
+  const char *name;
+  int size;
+};
+
+static const CacheDiscoveryPass::SkbAPI SkbAPIs[] = {
+    {"__alloc_skb", 0},
+    {"alloc_skb", 0},
+    {"alloc_skb_fclone", 0},
+    {"alloc_skb_with_frags", 0},
+    {"sock_alloc_send_pskb", 1},
+    {"sock_wmalloc", 1},
+};
+
+void CacheInventory::add(const CacheInfo &info) {
+  unsigned idx = Caches.size();
+  Caches.push_back(info);
+  for (StrId dest : info.dests)
+    Dests.insert(std::make_pair(dest, idx));
+  if (!info.site)
+    return;
+  Sites[info.site] = idx;
+  ModuleSites[info.site->getModule()].push_back(idx);
+}
+
+StringRef CacheInventory::resolveAllocAPI(StringRef callee,
+                                          bool *cacheArg) const {
+  if (cacheArg)
+    *cacheArg = true;
+  if (Wrappers.empty())
+    return callee;
+  StrId id = StringInterner::global().lookup(callee);
+  if (id == StringInterner::InvalidId)
+    return callee;
+  auto itr = Wrappers.find(id);
+  if (itr == Wrappers.end())
+    return callee;
+  if (cacheArg)
+    *cacheArg = itr->second.cacheArg;
+  return internedStr(itr->second.api);
+}
+
+StringRef CacheInventory::resolveAllocAPI(const Function *callee,
+                                          bool *cacheArg) const {
+  if (!callee->hasLocalLinkage())
+    return resolveAllocAPI(callee->getName(), cacheArg);
+  if (cacheArg)
+    *cacheArg = true;
+  if (Wrappers.empty())
+    return callee->getName();
+  auto itr = Wrappers.find(lookupStr(getWrapperName(callee)));
+  if (itr == Wrappers.end())
+    return callee->getName();
+  if (cacheArg)
+    *cacheArg = itr->second.cacheArg;
+  return internedStr(itr->second.api);
+}
+
+std::string CacheInventory::getWrapperName(const Function *F) {
+  if (F->hasLocalLinkage())
+    return getScopeName(F);
+  return F->getName().str();
+}
+
+const CacheInfo *CacheInventory::lookupCreationSite(CallInst *CI) const {
+  auto itr = Sites.find(CI);
+  if (itr == Sites.end())
+    return nullptr;
+  return &Caches[itr->second];
+}
+
+void CacheInventory::forgetSites(const Module *M) {
+  auto itr = ModuleSites.find(M);
+  if (itr == ModuleSites.end())
+    return;
+  for (unsigned idx : itr->second) {
+    Sites.erase(Caches[idx].site);
+    Caches[idx].site = nullptr;
+  }
+  ModuleSites.erase(itr);
+}
+
+const CacheInfo *CacheInventory::lookup(StrId dest) const {
+  auto itr = Dests.find(dest);
+  if (itr == Dests.end()) {
+    auto pool = PoolCaches.find(dest);
+    if (pool == PoolCaches.end())
+      return nullptr;
+    itr = Dests.find(pool->second);
+    if (itr == Dests.end())
+      return nullptr;
+  }
+  return &Caches[itr->second];
+}
+
+std::string CacheInventory::getProtoId(const GlobalValue *GV) {
+  return "proto." + getScopeName(GV);
+}
+
+void CacheInventory::addProto(StrId id, const ProtoInfo &proto) {
+  if (Protos.insert(std::make_pair(id, proto)).second)
+    addProtoCache(id);
+}
+
+void CacheInventory::addProtoRegistration(StrId id, bool slab) {
+  if (ProtoRegs.insert(std::make_pair(id, slab)).second)
+    addProtoCache(id);
+}
+
+// proto_register creates the cache with the name, object size and usercopy
+// window of the initializer, and no alignment or constructor
+void CacheInventory::addProtoCache(StrId id) {
+  auto proto = Protos.find(id);
+  auto reg = ProtoRegs.find(id);
+  if (proto == Protos.end() || reg == ProtoRegs.end())
+    return;
+  if (!reg->second) {
+    KmallocDests.insert(id);
+    return;
+  }
+
+  CacheInfo info;
+  info.name = proto->second.name;
+  info.size = proto->second.objSize;
+  info.align = 0;
+  info.useroffset = proto->second.useroffset;
+  info.usersize = proto->second.usersize;
+  info.dests.push_back(id);
+  add(info);
+}
+
+void CacheInventory::addPool(StrId pool, StrId cacheDest) {
+  PoolCaches.insert(std::make_pair(pool, cacheDest));
+}
+
+void CacheInventory::addBioset(StrId bioset, uint64_t size) {
+  auto itr = BioCaches.find(size);
+  if (itr != BioCaches.end()) {
+    Caches[itr->second].dests.push_back(bioset);
+    Dests.insert(std::make_pair(bioset, itr->second));
+    return;
+  }
+
+  // created by bio_find_or_create_slab, without a usercopy window
+  CacheInfo info;
+  info.name = "bio-" + std::to_string(size);
+  info.size = size;
+  info.useroffset = 0;
+  info.usersize = 0;
+  info.dests.push_back(bioset);
+  BioCaches[size] = Caches.size();
+  add(info);
+}
+
+bool CacheInventory::isKmallocDest(StringRef id) const {
+  StrId key = StringInterner::global().lookup(id);
+  return key != StringInterner::InvalidId && KmallocDests.count(key);
+}
+
+// a pool is the location its pointer is loaded from, or the embedded pool
+// itself
+static std::string getPoolId(BackwardSlicer &slicer, Value *V, Module *M) {
+  if (LoadInst *LI = slicer.getSourceLoad(V))
+    return getAnnotation(LI->getPointerOperand(), M);
+  Value *src = slicer.getSource(V);
+  return src ? getAnnotation(src->stripPointerCasts(), M) : "";
+}
+
+std::string CacheInventory::getAllocSiteDest(CallInst *CI,
+                                             BackwardSlicer &slicer) {
+  Function *F = CI->getCalledFunction();
+  if (F && F->getName() == "sk_alloc") {
+    if (CI->arg_size() < 4)
+      return "";
+    Value *prot = slicer.getSource(CI->getArgOperand(3));
+    auto *GV = dyn_cast_or_null<GlobalVariable>(
+        prot ? prot->stripPointerCasts() : nullptr);
+    return GV ? getProtoId(GV) : "";
+  }
+
+  if (CI->arg_size() < 1)
+    return "";
+
+  // the bio_set comes last, before and after bio_alloc_bioset gained the
+  // block device and op arguments
+  if (F && F->getName() == "mempool_alloc")
+    return getPoolId(slicer, CI->getArgOperand(0), CI->getModule());
+  if (F && F->getName() == "bio_alloc_bioset")
+    return getPoolId(slicer, CI->getArgOperand(CI->arg_size() - 1),
+                     CI->getModule());
+
+  LoadInst *LI = slicer.getSourceLoad(CI->getArgOperand(0));
+  if (!LI)
+    return "";
+  return getAnnotation(LI->getPointerOperand(), CI->getModule());
+}
+
+StringRef CacheInventory::lookupAllocSiteDest(CallInst *CI) const {
+  {
+    std::lock_guard<std::mutex> Guard(DestLock);
+    auto itr = SiteDests.find(CI);
+    if (itr != SiteDests.end())
+      return itr->second;
+  }
+
+  // sliced unlocked, a call asked about twice at once gets the same id.
+  // the map's elements stay put as it grows
+  BackwardSlicer slicer;
+  std::string id = getAllocSiteDest(CI, slicer);
+  std::lock_guard<std::mutex> Guard(DestLock);
+  auto inserted = SiteDests.insert(std::make_pair(CI, std::move(id)));
+  if (inserted.second)
+    ModuleDests[CI->getModule()].push_back(CI);
+  return inserted.first->second;
+}
+
+void CacheInventory::forgetAllocSites(const Module *M) {
+  std::lock_guard<std::mutex> Guard(DestLock);
+  auto itr = ModuleDests.find(M);
+  if (itr == ModuleDests.end())
+    return;
+  for (CallInst *CI : itr->second)
+    SiteDests.erase(CI);
+  ModuleDests.erase(itr);
+}
+
+const CacheInfo *CacheInventory::lookupAllocSite(CallInst *CI) const {
+  StringRef id = lookupAllocSiteDest(CI);
+  StrId dest = id.empty() ? StringInterner::InvalidId : lookupStr(id);
+  if (dest != StringInterner::InvalidId) {
+    if (const CacheInfo *cache = lookup(dest))
+      return cache;
+  }
+
+  auto itr = AllocSites.find(CI);
+  if (itr == AllocSites.end())
+    return nullptr;
+  return &Caches[itr->second];
+}
+
+bool CacheInventory::addAllocSiteCache(CallInst *CI, CallInst *create) {
+  auto itr = Sites.find(create);
+  if (itr == Sites.end())
+    return false;
+  AllocSites[CI] = itr->second;
+  return true;
+}
+
+// offsetof/sizeof arithmetic may survive as a constant expression
+static uint64_t getConstInt(Constant *C, const DataLayout &DL) {
+  if (isa<ConstantExpr>(C))
+    C = ConstantFoldConstant(C, DL);
+  if (auto *CInt = dyn_cast<ConstantInt>(C))
+    return CInt->getZExtValue();
+  return CacheInfo::Unknown;
+}
+
+static uint64_t getConstArg(BackwardSlicer &slicer, CallInst *CI, int no) {
+  if (no < 0 || (unsigned)no >= CI->arg_size())
+    return CacheInfo::Unknown;
+
+  // spilled to the stack without optimization
+  Constant *C = slicer.getSourceConstant(CI->getArgOperand(no));
+  if (!C)
+    return CacheInfo::Unknown;
+  return getConstInt(C, CI->getModule()->getDataLayout());
+}
+
+// locations the cache pointer V is stored to, through casts
+static void collectDests(Value *V, Module *M, std::vector<StrId> &dests) {
+  for (User *U : V->users()) {
+    if (auto *SI = dyn_cast<StoreInst>(U)) {
+      if (SI->getValueOperand() != V)
+        continue;
+      std::string id = getAnnotation(SI->getPointerOperand(), M);
+      if (!id.empty())
+        dests.push_back(internStr(id));
+    } else if (isa<CastInst>(U)) {
+      collectDests(U, M, dests);
+    }
+  }
+}
+
+// a constant C string, also in a char array longer than the string
+static std::string getConstString(Constant *C) {
+  auto *CDS = dyn_cast<ConstantDataSequential>(C);
+  if (!CDS || !CDS->isString())
+    return "";
+  StringRef str = CDS->getAsString();
+  return str.substr(0, str.find('\0')).str();
+}
+
+// struct proto, the type of G in its debug info
+static const DICompositeType *getProtoDIType(const GlobalVariable &G) {
+  SmallVector<DIGlobalVariableExpression *, 1> GVEs;
+  G.getDebugInfo(GVEs);
+  for (auto *GVE : GVEs) {
+    const DIType *T = GVE->getVariable()->getType();
+    // through typedefs and qualifiers
+    while (auto *DT = dyn_cast_or_null<DIDerivedType>(T)) {
+      if (DT->getTag() == dwarf::DW_TAG_pointer_type)
+        return nullptr;
+      T = DT->getBaseType();
+    }
+    auto *CT = dyn_cast_or_null<DICompositeType>(T);
+    if (CT && CT->getTag() == dwarf::DW_TAG_structure_type &&
+        CT->getName() == "proto")
+      return CT;
+  }
+  return nullptr;
+}
+
+// initializers of protocols, a literal struct when they initialize a union.
+// the fields are found by name in the debug info, without it only the name
+// is read, from the one char array of struct proto
+void CacheDiscoveryPass::addProto(GlobalVariable &G) {
+  auto *CS = dyn_cast<ConstantStruct>(G.getInitializer());
+  if (!CS)
+    return;
+  StructType *ST = CS->getType();
+  const DICompositeType *DI = getProtoDIType(G);
+  if (!DI && (ST->isLiteral() || getStructName(ST) != "struct.proto"))
+    return;
+
+  ProtoInfo proto;
+  if (!DI) {
+    for (unsigned i = 0; i < CS->getNumOperands() && proto.name.empty(); ++i)
+      proto.name = getConstString(CS->getOperand(i));
+  } else {
+    const DataLayout &DL = G.getParent()->getDataLayout();
+    const StructLayout *SL = DL.getStructLayout(ST);
+    for (DINode *E : DI->getElements()) {
+      auto *member = dyn_cast_or_null<DIDerivedType>(E);
+      if (!member || member->getTag() != dwarf::DW_TAG_member ||
+          member->isBitField())
+        continue;
+      uint64_t offset = member->getOffsetInBits() / 8;
+      if (offset >= SL->getSizeInBytes())
+        continue;
+      unsigned idx = SL->getElementContainingOffset(offset);
+      if (SL->getElementOffset(idx) != offset)
+        continue;
+
+      Constant *C = CS->getOperand(idx);
+      StringRef name = member->getName();
+      if (name == "name")
+        proto.name = getConstString(C);
+      else if (name == "obj_size")
+        proto.objSize = getConstInt(C, DL);
+      else if (name == "useroffset")
+        proto.useroffset = getConstInt(C, DL);
+      else if (name == "usersize")
+        proto.usersize = getConstInt(C, DL);
+    }
+  }
+
+  KA_LOGS(2, "proto " << proto.name << " in " << G.getName() << "\n");
+  Ctx->Caches.addProto(internStr(CacheInventory::getProtoId(&G)), proto);
+}
+
+void CacheDiscoveryPass::addCreationSite(CallInst *CI, const CreateAPI &API) {
+  CacheInfo info;
+  info.site = CI;
+
+  if (CI->arg_size() > 0) {
+    Value *name = CI->getArgOperand(0)->stripPointerCasts();
+    if (auto *GV = dyn_cast<GlobalVariable>(name)) {
+      if (GV->hasInitializer()) {
+        if (auto *CDS =
+                dyn_cast<ConstantDataSequential>(GV->getInitializer())) {
+          if (CDS->isCString())
+            info.name = CDS->getAsCString().str();
+        }
+      }
+    }
+  }
+
+  info.size = getConstArg(Slicer, CI, API.size);
+  info.align = getConstArg(Slicer, CI, API.align);
+  info.flags = getConstArg(Slicer, CI, API.flags);
+
+  if (API.useroffset >= 0) {
+    info.useroffset = getConstArg(Slicer, CI, API.useroffset);
+    info.usersize = getConstArg(Slicer, CI, API.usersize);
+  } else if (!API.argsStruct) {
+    info.useroffset = 0;
+    info.usersize = 0;
+  }
+
+  if (API.ctor >= 0 && (unsigned)API.ctor < CI->arg_size()) {
+    Value *ctor = CI->getArgOperand(API.ctor)->stripPointerCasts();
+    if (auto *F = dyn_cast<Function>(ctor))
+      info.ctor = getScopeName(F);
+  }
+
+  collectDests(CI, CI->getModule(), info.dests);
+
+  KA_LOGS(2, "cache " << info.name << " created in "
+                      << CI->getFunction()->getName() << "\n");
+  Ctx->Caches.add(info);
+}
+
+// direct calls of F, or calls through a cast of its declaration
+static void forEachCall(Function *F, function_ref<void(CallInst *)> fn) {
+  SmallVector<User *, 16> Users(F->users());
+  for (unsigned i = 0; i < Users.size(); ++i) {
+    User *U = Users[i];
+    if (auto *CE = dyn_cast<ConstantExpr>(U)) {
+      if (CE->isCast())
+        Users.append(CE->user_begin(), CE->user_end());
+      continue;
+    }
+
+    auto *CI = dyn_cast<CallInst>(U);
+    if (CI && CI->getCalledOperand()->stripPointerCasts() == F)
+      fn(CI);
+  }
+}
+
+// ids of the pool CI creates, the locations the pool pointer is stored to
+// or that of the embedded pool
+static void getCreatedIds(BackwardSlicer &slicer, CallInst *CI, int arg,
+                          std::vector<StrId> &ids) {
+  if (arg < 0) {
+    collectDests(CI, CI->getModule(), ids);
+    return;
+  }
+  if ((unsigned)arg >= CI->arg_size())
+    return;
+  std::string id = getPoolId(slicer, CI->getArgOperand(arg), CI->getModule());
+  if (!id.empty())
+    ids.push_back(internStr(id));
+}
+
+void CacheDiscoveryPass::addPoolCreationSite(CallInst *CI, const PoolAPI &API) {
+  if ((unsigned)API.data >= CI->arg_size())
+    return;
+
+  bool slab = API.slab;
+  if (API.allocFn >= 0) {
+    if ((unsigned)API.allocFn >= CI->arg_size())
+      return;
+    auto *F = dyn_cast<Function>(
+        CI->getArgOperand(API.allocFn)->stripPointerCasts());
+    if (!F || (F->getName() != "mempool_alloc_slab" &&
+               F->getName() != "mempool_kmalloc"))
+      return;
+    slab = F->getName() == "mempool_alloc_slab";
+  }
+
+  std::vector<StrId> pools;
+  getCreatedIds(Slicer, CI, API.pool, pools);
+  if (pools.empty())
+    return;
+
+  if (!slab) {
+    for (StrId pool : pools)
+      Ctx->Caches.addKmallocPool(pool);
+    return;
+  }
+
+  // the cache pointer, loaded from where it was stored
+  LoadInst *LI = Slicer.getSourceLoad(CI->getArgOperand(API.data));
+  if (!LI)
+    return;
+  std::string dest = getAnnotation(LI->getPointerOperand(), CI->getModule());
+  if (dest.empty())
+    return;
+  for (StrId pool : pools)
+    Ctx->Caches.addPool(pool, internStr(dest));
+}
+
+static uint64_t getStructSize(Module *M, StringRef name) {
+  for (StructType *T : M->getIdentifiedStructTypes()) {
+    if (!T->isOpaque() && getStructName(T) == name)
+      return M->getDataLayout().getTypeAllocSize(T);
+  }
+  return CacheInfo::Unknown;
+}
+
+// bios are allocated with the front pad before and the inline vecs after
+// them, the cache is named after the sum. only the size of struct bio is
+// needed from the module, so a constant pad is resolved anywhere
+void CacheDiscoveryPass::addBiosetCreationSite(CallInst *CI,
+                                               const BiosetAPI &API,
+                                               uint64_t bioSize) {
+  uint64_t frontPad = getConstArg(Slicer, CI, API.frontPad);
+  uint64_t flags = getConstArg(Slicer, CI, API.flags);
+  if (frontPad == CacheInfo::Unknown || flags == CacheInfo::Unknown ||
+      bioSize == CacheInfo::Unknown)
+    return;
+
+  std::vector<StrId> biosets;
+  getCreatedIds(Slicer, CI, API.bioset, biosets);
+  uint64_t size =
+      frontPad + bioSize + (flags & BiosetNeedBvecs ? BioInlineVecsSize : 0);
+  for (StrId bioset : biosets)
+    Ctx->Caches.addBioset(bioset, size);
+}
+
+static bool isSkbAPI(StringRef name) {
+  for (auto &API : SkbAPIs) {
+    if (name == API.name)
+      return true;
+  }
+  return false;
+}
+
+// the allocator a call to F ends up in, and whether its first argument is
+// the cache. false if F is not known to allocate
+static bool getAllocator(const CacheInventory &inv, const Function *F,
+                         StringRef &api, bool &cacheArg) {
+  StringRef name = F->getName();
+  // the slab fast path every allocation goes through, it is inlined on
+  // most configurations
+  if (name == "slab_alloc_node") {
+    api = "kmem_cache_alloc";
+    cacheArg = true;
+    return true;
+  }
+  // __kmalloc_noprof, __kmalloc_node_track_caller, __kmalloc_cache_noprof,
+  // and the like
+  if (name.startswith("__kmalloc") && !AllocAPIs.count(name)) {
+    api = "__kmalloc";
+    cacheArg = false;
+    return true;
+  }
+  api = inv.resolveAllocAPI(F, &cacheArg);
+  return AllocAPIs.count(api);
+}
+
+// functions returning the result of a call, through casts and phis, with
+// whether the first argument of the function is passed on as the first
+static void collectForwards(Function &F,
+                            SmallVectorImpl<std::pair<Function *, bool>> &out) {
+  Value *Arg0 = F.arg_empty() ? nullptr : F.getArg(0);
+  SmallPtrSet<Value *, 8> seen;
+  SmallVector<Value *, 8> worklist;
+  for (BasicBlock &BB : F) {
+    if (auto *RI = dyn_cast<ReturnInst>(BB.getTerminator()))
+      if (Value *RV = RI->getReturnValue())
+        worklist.push_back(RV);
+  }
+
+  while (!worklist.empty()) {
+    Value *V = worklist.pop_back_val()->stripPointerCasts();
+    if (!seen.insert(V).second)
+      continue;
+    if (auto *PN = dyn_cast<PHINode>(V)) {
+      for (Value *In : PN->incoming_values())
+        worklist.push_back(In);
+    } else if (auto *CI = dyn_cast<CallInst>(V)) {
+      Function *Callee = CI->getCalledFunction();
+      if (!Callee || !Callee->hasName() || Callee == &F)
+        continue;
+      bool cacheArg = Arg0 && CI->arg_size() > 0 &&
+                      CI->getArgOperand(0)->stripPointerCasts() == Arg0;
+      out.push_back(std::make_pair(Callee, cacheArg));
+    }
+  }
+}
+
+void CacheDiscoveryPass::addForward(Function *caller, Function *callee,
+                                    bool cacheArg) {
+  // a new wrapper completes the chains waiting for it
+  SmallVector<std::pair<Forward, Function *>, 8> worklist;
+  worklist.push_back(std::make_pair(Forward{caller, cacheArg}, callee));
+  while (!worklist.empty()) {
+    Forward W = worklist.back().first;
+    Function *to = worklist.back().second;
+    worklist.pop_back();
+
+    StringRef api;
+    bool calleeCacheArg;
+    if (getAllocator(Ctx->Caches, W.caller, api, calleeCacheArg))
+      continue;
+    if (!getAllocator(Ctx->Caches, to, api, calleeCacheArg)) {
+      Forwards[internStr(CacheInventory::getWrapperName(to))].push_back(W);
+      continue;
+    }
+
+    // kmalloc_trace and the like take a kmalloc cache, they still allocate
+    // by size
+    StrId wrapper = internStr(CacheInventory::getWrapperName(W.caller));
+    if (W.caller->getName().startswith("kmalloc"))
+      Ctx->Caches.addWrapper(wrapper, internStr("__kmalloc"));
+    else
+      Ctx->Caches.addWrapper(wrapper, internStr(api),
+                             W.cacheArg && calleeCacheArg);
+
+    auto itr = Forwards.find(wrapper);
+    if (itr == Forwards.end())
+      continue;
+    for (const Forward &F : itr->second)
+      worklist.push_back(std::make_pair(F, W.caller));
+    Forwards.erase(itr);
+  }
+}
+
+void CacheDiscoveryPass::inferAllocWrappers(Module *M) {
+  for (Function &F : *M) {
+    if (F.isDeclaration() || !F.hasName())
+      continue;
+    StringRef api;
+    bool cacheArg;
+    if (getAllocator(Ctx->Caches, &F, api, cacheArg))
+      continue;
+    SmallVector<std::pair<Function *, bool>, 4> forwards;
+    collectForwards(F, forwards);
+    for (auto &item : forwards)
+      addForward(&F, item.first, item.second);
+  }
+}
+
+bool CacheDiscoveryPass::doInitialization(Module *M) {
+  // M's bodies may be stripped once it is done
+  Slicer.clear();
+  inferAllocWrappers(M);
+
+  for (auto &API : CreateAPIs) {
+    if (Function *F = M->getFunction(API.name))
+      forEachCall(F, [&](CallInst *CI) { addCreationSite(CI, API); });
+  }
+
+  for (GlobalVariable &G : M->globals()) {
+    if (G.hasInitializer() && G.getValueType()->isStructTy())
+      addProto(G);
+  }
+  for (auto &API : PoolAPIs) {
+    if (Function *F = M->getFunction(API.name))
+      forEachCall(F, [&](CallInst *CI) { addPoolCreationSite(CI, API); });
+  }
+  uint64_t bioSize = CacheInfo::Unknown;
+  for (auto &API : BiosetAPIs) {
+    Function *F = M->getFunction(API.name);
+    if (!F)
+      continue;
+    if (bioSize == CacheInfo::Unknown)
+      bioSize = getStructSize(M, "struct.bio");
+    forEachCall(F, [&](CallInst *CI) {
+      addBiosetCreationSite(CI, API, bioSize);
+    });
+  }
+
+  if (Function *F = M->getFunction("proto_register")) {
+    forEachCall(F, [&](CallInst *CI) {
+      if (CI->arg_size() < 2)
+        return;
+      Value *prot = CI->getArgOperand(0)->stripPointerCasts();
+      auto *GV = dyn_cast<GlobalVariable>(prot);
+      uint64_t slab = getConstArg(Slicer, CI, 1);
+      if (GV && slab != CacheInfo::Unknown)
+        Ctx->Caches.addProtoRegistration(
+            internStr(CacheInventory::getProtoId(GV)), slab != 0);
+    });
+  }
+
+  // the copies of a body were seen in its first module, the wrappers in
+  // the table pass on a size they don't know
+  for (auto &API : SkbAPIs) {
+    Function *F = M->getFunction(API.name);
+    if (!F)
+      continue;
+    forEachCall(F, [&](CallInst *CI) {
+      Function *Caller = CI->getFunction();
+      if (Ctx->isDuplicateFunc(Caller) || isSkbAPI(Caller->getName()))
+        return;
+      Ctx->SkbAllocs.push_back(
+          {getScopeName(Caller), API.name,
+           getConstArg(Slicer, CI, API.size)});
+    });
+  }
+
+  return false;
+}
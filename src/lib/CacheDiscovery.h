@@ -0,0 +1,59 @@
+#ifndef _CACHE_DISCOVERY_H
+#define _CACHE_DISCOVERY_H
+
+#include "BackwardSlice.h"
+#include "GlobalCtx.h"
+
+// Builds the cache inventory from the use lists of the kmem_cache creation
+// APIs, linear in the number of creation sites. Protocol caches are created
+// by proto_register from struct proto initializers, which are joined with
+// the registrations across modules. Mempools and bio_sets are tied to the
+// caches behind them. The skb allocations are collected on
+// the way, their data buffers are sized at report time.
+//
+// Allocation wrappers are inferred from the bodies returning what an
+// allocator returned, slab_alloc_node, the __kmalloc family, a known API or
+// another wrapper, and added to the inventory before the sites are looked
+// for. A wrapper may be defined in a module loaded after its callers,
+// except with StripBodies: each module is scanned and stripped as it is
+// loaded, so its calls to wrappers not known yet are not sites.
+class CacheDiscoveryPass : public IterativeModulePass {
+public:
+  // argument layout of one creation API
+  struct CreateAPI;
+  struct SkbAPI;
+  struct PoolAPI;
+  struct BiosetAPI;
+
+private:
+  void addCreationSite(llvm::CallInst *CI, const CreateAPI &API);
+  void addProto(llvm::GlobalVariable &G);
+  void addPoolCreationSite(llvm::CallInst *CI, const PoolAPI &API);
+  void addBiosetCreationSite(llvm::CallInst *CI, const BiosetAPI &API,
+                             uint64_t bioSize);
+
+  // a function returning the result of another, by the wrapper name of
+  // the latter until that is known to allocate. cacheArg is set when the
+  // first argument is passed on as the first
+  struct Forward {
+    llvm::Function *caller;
+    bool cacheArg;
+  };
+  std::unordered_map<StrId, std::vector<Forward>> Forwards;
+
+  void inferAllocWrappers(llvm::Module *M);
+
+  // shared by the queries about one module
+  BackwardSlicer Slicer;
+  void addForward(llvm::Function *caller, llvm::Function *callee,
+                  bool cacheArg);
+
+public:
+  CacheDiscoveryPass(GlobalContext *Ctx_)
+      : IterativeModulePass(Ctx_, "CacheDiscovery") {}
+  virtual bool doInitialization(llvm::Module *);
+  virtual bool doFinalization(llvm::Module *) { return false; }
+  virtual bool doModulePass(llvm::Module *) { return false; }
+};
+
+#endif
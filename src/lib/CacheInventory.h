@@ -0,0 +1,175 @@
+#ifndef _CACHE_INVENTORY_H
+#define _CACHE_INVENTORY_H
+
+#include <llvm/IR/Instructions.h>
+#include <llvm/Support/raw_ostream.h>
+
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include "StringInterner.h"
+
+class BackwardSlicer;
+class FuncAACache;
+
+// one kmem_cache creation site
+struct CacheInfo {
+  static const uint64_t Unknown = ~0ULL;
+
+  // empty when the name is not a constant string
+  std::string name;
+  uint64_t size = Unknown;
+  uint64_t align = Unknown;
+  uint64_t flags = Unknown;
+  // scope name of the constructor, empty if there is none
+  std::string ctor;
+  // hardened usercopy whitelist, empty for caches not created with one
+  uint64_t useroffset = Unknown;
+  uint64_t usersize = Unknown;
+  // annotation ids of the globals / fields the cache pointer is stored to
+  std::vector<StrId> dests;
+  // null once the body is stripped, or for a cache of a core summary
+  llvm::CallInst *site = nullptr;
+};
+
+// a struct proto initializer. proto_register creates the cache of the
+// protocol's sockets from it, unless asked to leave them to kmalloc
+struct ProtoInfo {
+  std::string name;
+  uint64_t objSize = CacheInfo::Unknown;
+  uint64_t useroffset = CacheInfo::Unknown;
+  uint64_t usersize = CacheInfo::Unknown;
+};
+
+// the part of an object that may be copied from or to user space
+struct UsercopyWindow {
+  uint64_t offset = CacheInfo::Unknown;
+  uint64_t size = CacheInfo::Unknown;
+};
+
+// a size, flag or window field of the above, "?" when it is Unknown
+static inline void printCacheField(llvm::raw_ostream &OS, uint64_t value) {
+  if (value == CacheInfo::Unknown)
+    OS << "?";
+  else
+    OS << value;
+}
+
+// Every cache created in the loaded modules, found forward from the
+// creation calls. Allocation sites find their cache through the id of the
+// location they load the cache pointer from.
+class CacheInventory {
+public:
+  void add(const CacheInfo &info);
+
+  const std::vector<CacheInfo> &caches() const { return Caches; }
+  size_t size() const { return Caches.size(); }
+
+  // the cache stored to the location with this annotation id, or backing
+  // the pool there
+  const CacheInfo *lookup(StrId dest) const;
+  // the cache a kmem_cache_alloc-like call allocates from
+  const CacheInfo *lookupAllocSite(llvm::CallInst *CI) const;
+  // the cache a kmem_cache_create-like call creates
+  const CacheInfo *lookupCreationSite(llvm::CallInst *CI) const;
+  // a kmem_cache_alloc-like call whose cache pointer can only come from
+  // create, as the points-to analysis found. looked up when the location
+  // it loads from doesn't tell. false if create isn't a creation site
+  bool addAllocSiteCache(llvm::CallInst *CI, llvm::CallInst *create);
+
+  // annotation id of the location a kmem_cache_alloc-like call loads its
+  // cache from, empty if it isn't a plain load. that of the protocol for
+  // sk_alloc, of the pool for mempool_alloc and bio_alloc_bioset
+  static std::string getAllocSiteDest(llvm::CallInst *CI,
+                                      BackwardSlicer &slicer);
+  // the same, sliced once per call and kept. safe to call from pool
+  // workers
+  llvm::StringRef lookupAllocSiteDest(llvm::CallInst *CI) const;
+  // the calls in M are about to go with their function bodies
+  void forgetAllocSites(const llvm::Module *M);
+
+  // struct proto initializers and proto_register calls, in any order. a
+  // protocol registered with a slab gets its cache, stored to the location
+  // with the protocol's id
+  void addProto(StrId id, const ProtoInfo &proto);
+  void addProtoRegistration(StrId id, bool slab);
+  // the location id sk_alloc "loads" the cache from for protocol GV
+  static std::string getProtoId(const llvm::GlobalValue *GV);
+
+  // mempools backed by the cache stored to cacheDest, or by kmalloc. the
+  // pool is the location its pointer is stored to, or that of the pool
+  // itself when it is embedded
+  void addPool(StrId pool, StrId cacheDest);
+  void addKmallocPool(StrId pool) { KmallocDests.insert(pool); }
+  // a bio_set, its bios come from the cache "bio-<size>" shared by the
+  // bio_sets of the same size
+  void addBioset(StrId bioset, uint64_t size);
+
+  // the pool or protocol at this location allocates with kmalloc
+  bool isKmallocDest(llvm::StringRef id) const;
+
+  // the creation calls in M are about to go with their function bodies
+  void forgetSites(const llvm::Module *M);
+
+  // an allocation wrapper, inferred from its body or read from a core
+  // kernel summary, and the API it ends up in. cacheArg is set when its
+  // first argument is passed on as the first one of the API, so it is the
+  // cache for kmem_cache_alloc and the like
+  struct AllocWrapper {
+    StrId api;
+    bool cacheArg;
+  };
+
+  // calls to wrappers are allocation sites as well. the first one added
+  // for a name (see getWrapperName) wins
+  void addWrapper(StrId wrapper, StrId api, bool cacheArg = false) {
+    Wrappers.insert(std::make_pair(wrapper, AllocWrapper{api, cacheArg}));
+  }
+  const std::unordered_map<StrId, AllocWrapper> &wrappers() const {
+    return Wrappers;
+  }
+  // the API a call to callee allocates through, callee itself unless it is
+  // a known wrapper. cacheArg receives whether the first arguments match
+  llvm::StringRef resolveAllocAPI(llvm::StringRef callee,
+                                  bool *cacheArg = nullptr) const;
+  llvm::StringRef resolveAllocAPI(const llvm::Function *callee,
+                                  bool *cacheArg = nullptr) const;
+  // the name F is known by as a wrapper. static functions are told apart
+  // from those of the same name in other modules by their scope name
+  static std::string getWrapperName(const llvm::Function *F);
+
+  // the alias analysis a site may be resolved with, null if there is none
+  void setAliasCache(FuncAACache *AA_) { AA = AA_; }
+  FuncAACache *getAliasCache() const { return AA; }
+
+private:
+  // once both halves of a protocol are known
+  void addProtoCache(StrId id);
+
+  std::vector<CacheInfo> Caches;
+  // the first cache stored to a location wins
+  std::unordered_map<StrId, unsigned> Dests;
+  std::unordered_map<llvm::CallInst *, unsigned> Sites;
+  std::unordered_map<llvm::CallInst *, unsigned> AllocSites;
+  std::unordered_map<const llvm::Module *, std::vector<unsigned>> ModuleSites;
+  std::unordered_map<StrId, AllocWrapper> Wrappers;
+  std::unordered_map<StrId, ProtoInfo> Protos;
+  // whether the protocol was registered with alloc_slab
+  std::unordered_map<StrId, bool> ProtoRegs;
+  // pool to the location of its cache, looked up when asked
+  std::unordered_map<StrId, StrId> PoolCaches;
+  std::unordered_map<uint64_t, unsigned> BioCaches;
+  std::unordered_set<StrId> KmallocDests;
+  FuncAACache *AA = nullptr;
+  // lookupAllocSiteDest's, by call and by the module of the call
+  mutable std::mutex DestLock;
+  mutable std::unordered_map<llvm::CallInst *, std::string> SiteDests;
+  mutable std::unordered_map<const llvm::Module *,
+                             std::vector<llvm::CallInst *>>
+      ModuleDests;
+};
+
+#endif
@@ -14,6 +14,7 @@
 #include <llvm/IR/Constants.h>
 #include <llvm/IR/DebugInfo.h>
 #include <llvm/IR/InstIterator.h>
+#include <llvm/IR/InstVisitor.h>
 #include <llvm/IR/Instructions.h>
 #include <llvm/IR/Module.h>
 #include <llvm/Pass.h>
@@ -25,11 +26,11 @@
 using namespace llvm;
 
 Function *CallGraphPass::getFuncDef(Function *F) {
-  FuncMap::iterator it = Ctx->Funcs.find(getScopeName(F));
+  FuncMap::iterator it = Ctx->Funcs.find(internStr(getScopeName(F)));
   if (it != Ctx->Funcs.end())
     return it->second;
-  else
-    return F;
+  // collapse duplicated inline bodies onto one copy
+  return Ctx->getUnifiedFunc(F);
 }
 
 bool CallGraphPass::isCompatibleType(Type *T1, Type *T2) {
@@ -86,7 +87,9 @@ bool CallGraphPass::isCompatibleType(Type *T1, Type *T2) {
     }
 
     // not literal, use name?
-    return ST1->getStructName().equals(ST2->getStructName());
+    if (Ctx->Types.get(ST1) == Ctx->Types.get(ST2))
+      return true;
+    return getStructName(ST1) == getStructName(ST2);
   } else if (T1->isFunctionTy()) {
     FunctionType *FT1 = cast<FunctionType>(T1);
     FunctionType *FT2 = dyn_cast<FunctionType>(T2);
@@ -167,8 +170,7 @@ bool CallGraphPass::findCalleesByType(CallInst *CI, FuncSet &FS) {
   return false;
 }
 
-bool CallGraphPass::mergeFuncSet(FuncSet &S, const std::string &Id,
-                                 bool InsertEmpty) {
+bool CallGraphPass::mergeFuncSet(FuncSet &S, StrId Id, bool InsertEmpty) {
   FuncPtrMap::iterator i = Ctx->FuncPtrs.find(Id);
   if (i != Ctx->FuncPtrs.end())
     return mergeFuncSet(S, i->second);
@@ -177,7 +179,7 @@ bool CallGraphPass::mergeFuncSet(FuncSet &S, const std::string &Id,
   return false;
 }
 
-bool CallGraphPass::mergeFuncSet(std::string &Id, const FuncSet &S,
+bool CallGraphPass::mergeFuncSet(StrId Id, const FuncSet &S,
                                  bool InsertEmpty) {
   FuncPtrMap::iterator i = Ctx->FuncPtrs.find(Id);
   if (i != Ctx->FuncPtrs.end())
@@ -267,7 +269,7 @@ bool CallGraphPass::findFunctions(Value *V, FuncSet &S,
   // arguement, S = S + FuncPtrs[arg.ID]
   if (Argument *A = dyn_cast<Argument>(V)) {
     bool InsertEmpty = isFunctionPointer(A->getType());
-    return mergeFuncSet(S, getArgId(A), InsertEmpty);
+    return mergeFuncSet(S, internStr(getArgId(A)), InsertEmpty);
   }
 
   // return value, S = S + FuncPtrs[ret.ID]
@@ -275,11 +277,11 @@ bool CallGraphPass::findFunctions(Value *V, FuncSet &S,
     // update callsite info first
     FuncSet &FS = Ctx->Callees[CI];
     // FS.setCallerInfo(CI, &Ctx->Callers);
-    findFunctions(CI->getCalledFunction(), FS);
+    findFunctions(CI->getCalledOperand(), FS);
     bool Changed = false;
     for (Function *CF : FS) {
       bool InsertEmpty = isFunctionPointer(CI->getType());
-      Changed |= mergeFuncSet(S, getRetId(CF), InsertEmpty);
+      Changed |= mergeFuncSet(S, internStr(getRetId(CF)), InsertEmpty);
     }
     return Changed;
   }
@@ -289,7 +291,7 @@ bool CallGraphPass::findFunctions(Value *V, FuncSet &S,
     std::string Id = getLoadId(L);
     if (!Id.empty()) {
       bool InsertEmpty = isFunctionPointer(L->getType());
-      return mergeFuncSet(S, Id, InsertEmpty);
+      return mergeFuncSet(S, internStr(Id), InsertEmpty);
     } else {
       Function *f = L->getParent()->getParent();
       // errs() << "Empty LoadID: " << f->getName() << "::" << *L << "\n";
@@ -325,83 +327,107 @@ bool CallGraphPass::findCallees(CallInst *CI, FuncSet &FS) {
   return findCalleesByType(CI, FS);
 #else
   // use assignments based approach to find possible targets
-  return findFunctions(CI->getCalledFunction(), FS);
+  return findFunctions(CI->getCalledOperand(), FS);
 #endif
 }
 
-bool CallGraphPass::runOnFunction(Function *F) {
+// per-function transfer of the call graph, only calls, stores and returns
+// matter and InstVisitor dispatches on the opcode directly
+class CallGraphPass::FuncVisitor : public InstVisitor<FuncVisitor> {
+public:
+  FuncVisitor(CallGraphPass *Pass_, Function *F_) : Pass(Pass_), F(F_) {}
+
+  void visitCallInst(CallInst &CI);
+#ifndef TYPE_BASED
+  void visitStoreInst(StoreInst &SI);
+  void visitReturnInst(ReturnInst &RI);
+#endif
 
-  // Lewis: we don't give a shit to functions in .init.text
-  if (F->hasSection() && F->getSection().str() == ".init.text")
-    return false;
   bool Changed = false;
 
-  for (inst_iterator i = inst_begin(F), e = inst_end(F); i != e; ++i) {
-    Instruction *I = &*i;
-    // map callsite to possible callees
-    if (CallInst *CI = dyn_cast<CallInst>(I)) {
-      // ignore inline asm or intrinsic calls
-      if (CI->isInlineAsm() ||
-          (CI->getCalledFunction() && CI->getCalledFunction()->isIntrinsic()))
-        continue;
+private:
+  CallGraphPass *Pass;
+  Function *F;
+};
 
-      // might be an indirect call, find all possible callees
-      FuncSet &FS = Ctx->Callees[CI];
-      if (!findCallees(CI, FS))
-        continue;
+void CallGraphPass::FuncVisitor::visitCallInst(CallInst &CI) {
+  // ignore inline asm or intrinsic calls
+  if (CI.isInlineAsm() ||
+      (CI.getCalledFunction() && CI.getCalledFunction()->isIntrinsic()))
+    return;
+
+  // might be an indirect call, find all possible callees
+  FuncSet &FS = Pass->Ctx->Callees[&CI];
+  if (!Pass->findCallees(&CI, FS))
+    return;
 
 #ifndef TYPE_BASED
-      // looking for function pointer arguments
-      for (unsigned no = 0, ne = CI->getNumArgOperands(); no != ne; ++no) {
-        Value *V = CI->getArgOperand(no);
-        if (!isFunctionPointerOrVoid(V->getType()))
-          continue;
-
-        // find all possible assignments to the argument
-        FuncSet VS;
-        if (!findFunctions(V, VS))
-          continue;
-
-        // update argument FP-set for possible callees
-        for (Function *CF : FS) {
-          if (!CF) {
-            WARNING("NULL Function " << *CI << "\n");
-            assert(0);
-          }
-          std::string Id = getArgId(CF, no);
-          Changed |= mergeFuncSet(Ctx->FuncPtrs[Id], VS);
-        }
-      }
-#endif
-    }
-#ifndef TYPE_BASED
-    if (StoreInst *SI = dyn_cast<StoreInst>(I)) {
-      // stores to function pointers
-      Value *V = SI->getValueOperand();
-      if (isFunctionPointerOrVoid(V->getType())) {
-        std::string Id = getStoreId(SI);
-        if (!Id.empty()) {
-          FuncSet FS;
-          findFunctions(V, FS);
-          Changed |= mergeFuncSet(Id, FS, isFunctionPointer(V->getType()));
-        } else {
-          // errs() << "Empty StoreID: " << F->getName() << "::" << *SI << "\n";
-        }
-      }
-    } else if (ReturnInst *RI = dyn_cast<ReturnInst>(I)) {
-      // function returns
-      if (isFunctionPointerOrVoid(F->getReturnType())) {
-        Value *V = RI->getReturnValue();
-        std::string Id = getRetId(F);
-        FuncSet FS;
-        findFunctions(V, FS);
-        Changed |= mergeFuncSet(Id, FS, isFunctionPointer(V->getType()));
+  // looking for function pointer arguments
+  for (unsigned no = 0, ne = CI.getNumArgOperands(); no != ne; ++no) {
+    Value *V = CI.getArgOperand(no);
+    if (!isFunctionPointerOrVoid(V->getType()))
+      continue;
+
+    // find all possible assignments to the argument
+    FuncSet VS;
+    if (!Pass->findFunctions(V, VS))
+      continue;
+
+    // update argument FP-set for possible callees
+    for (Function *CF : FS) {
+      if (!CF) {
+        WARNING("NULL Function " << CI << "\n");
+        assert(0);
       }
+      StrId Id = internStr(getArgId(CF, no));
+      Changed |= Pass->mergeFuncSet(Pass->Ctx->FuncPtrs[Id], VS);
     }
+  }
 #endif
+}
+
+#ifndef TYPE_BASED
+void CallGraphPass::FuncVisitor::visitStoreInst(StoreInst &SI) {
+  // stores to function pointers
+  Value *V = SI.getValueOperand();
+  if (!isFunctionPointerOrVoid(V->getType()))
+    return;
+
+  std::string Id = getStoreId(&SI);
+  if (!Id.empty()) {
+    FuncSet FS;
+    Pass->findFunctions(V, FS);
+    Changed |=
+        Pass->mergeFuncSet(internStr(Id), FS, isFunctionPointer(V->getType()));
+  } else {
+    // errs() << "Empty StoreID: " << F->getName() << "::" << SI << "\n";
   }
+}
 
-  return Changed;
+void CallGraphPass::FuncVisitor::visitReturnInst(ReturnInst &RI) {
+  // function returns
+  if (isFunctionPointerOrVoid(F->getReturnType())) {
+    Value *V = RI.getReturnValue();
+    StrId Id = internStr(getRetId(F));
+    FuncSet FS;
+    Pass->findFunctions(V, FS);
+    Changed |= Pass->mergeFuncSet(Id, FS, isFunctionPointer(V->getType()));
+  }
+}
+#endif
+
+bool CallGraphPass::runOnFunction(Function *F) {
+
+  // Lewis: we don't give a shit to functions in .init.text
+  if (F->hasSection() && F->getSection().str() == ".init.text")
+    return false;
+  // duplicated bodies are analyzed once, through their unified copy
+  if (Ctx->isDuplicateFunc(F))
+    return false;
+
+  FuncVisitor Visitor(this, F);
+  Visitor.visit(F);
+  return Visitor.Changed;
 }
 
 // collect function pointer assignments in global initializers
@@ -423,7 +449,7 @@ void CallGraphPass::processInitializers(Module *M, Constant *C, GlobalValue *V,
       if (ETy->isStructTy()) {
         std::string new_id;
         if (Id.empty())
-          new_id = STy->getStructName().str() + "," + std::to_string(i);
+          new_id = getStructName(STy).str() + "," + std::to_string(i);
         else
           new_id = Id + "," + std::to_string(i);
         processInitializers(M, CS->getOperand(i), NULL, new_id);
@@ -435,8 +461,8 @@ void CallGraphPass::processInitializers(Module *M, Constant *C, GlobalValue *V,
         if (Function *F = dyn_cast<Function>(CS->getOperand(i))) {
           std::string new_id;
           if (!STy->isLiteral()) {
-            if (STy->getStructName().startswith("struct.anon.") ||
-                STy->getStructName().startswith("union.anon")) {
+            if (getStructName(STy).startswith("struct.anon.") ||
+                getStructName(STy).startswith("union.anon")) {
               if (Id.empty())
                 new_id = getStructId(STy, M, i);
             } else {
@@ -447,7 +473,7 @@ void CallGraphPass::processInitializers(Module *M, Constant *C, GlobalValue *V,
             assert(!Id.empty());
             new_id = Id + "," + std::to_string(i);
           }
-          Ctx->FuncPtrs[new_id].insert(getFuncDef(F));
+          Ctx->FuncPtrs[internStr(new_id)].insert(getFuncDef(F));
         }
       }
     }
@@ -459,7 +485,7 @@ void CallGraphPass::processInitializers(Module *M, Constant *C, GlobalValue *V,
     // global function pointer variables
     if (V) {
       std::string Id = getVarId(V);
-      Ctx->FuncPtrs[Id].insert(getFuncDef(F));
+      Ctx->FuncPtrs[internStr(Id)].insert(getFuncDef(F));
     }
   }
 }
@@ -467,6 +493,9 @@ void CallGraphPass::processInitializers(Module *M, Constant *C, GlobalValue *V,
 bool CallGraphPass::doInitialization(Module *M) {
 
   KA_LOGS(1, "[+] Initializing " << M->getModuleIdentifier() << "\n");
+  // precompute load/store ids on the worker pool
+  annotateModule(M, Ctx->Pool.get(), Ctx->Summaries.get(), Ctx->FuncHashes);
+
   // collect function pointer assignments in global initializers
   for (GlobalVariable &G : M->globals()) {
     if (G.hasInitializer())
@@ -479,7 +508,7 @@ bool CallGraphPass::doInitialization(Module *M) {
       continue;
     // collect address-taken functions
     if (F.hasAddressTaken())
-      Ctx->AddressTakenFuncs.insert(&F);
+      Ctx->AddressTakenFuncs.insert(Ctx->getUnifiedFunc(&F));
   }
 
   return false;
@@ -489,6 +518,8 @@ bool CallGraphPass::doFinalization(Module *M) {
 
   // update callee and caller mapping
   for (Function &F : *M) {
+    if (Ctx->isDuplicateFunc(&F))
+      continue;
     for (inst_iterator i = inst_begin(F), e = inst_end(F); i != e; ++i) {
       // map callsite to possible callees
       if (CallInst *CI = dyn_cast<CallInst>(&*i)) {
@@ -523,7 +554,7 @@ void CallGraphPass::dumpFuncPtrs() {
        i != e; ++i) {
     // if (i->second.empty())
     //    continue;
-    OS << i->first << "\n";
+    OS << internedStr(i->first) << "\n";
     FuncSet &v = i->second;
     for (FuncSet::iterator j = v.begin(), ej = v.end(); j != ej; ++j) {
       OS << "  " << ((*j)->hasInternalLinkage() ? "f" : "F") << " "
@@ -5,6 +5,8 @@
 
 class CallGraphPass : public IterativeModulePass {
 private:
+  class FuncVisitor;
+
   llvm::Function *getFuncDef(llvm::Function *F);
   bool runOnFunction(llvm::Function *);
   void processInitializers(llvm::Module *, llvm::Constant *,
@@ -12,8 +14,8 @@ private:
   bool findCallees(llvm::CallInst *, FuncSet &);
   bool isCompatibleType(llvm::Type *T1, llvm::Type *T2);
   bool findCalleesByType(llvm::CallInst *, FuncSet &);
-  bool mergeFuncSet(FuncSet &S, const std::string &Id, bool InsertEmpty);
-  bool mergeFuncSet(std::string &Id, const FuncSet &S, bool InsertEmpty);
+  bool mergeFuncSet(FuncSet &S, StrId Id, bool InsertEmpty);
+  bool mergeFuncSet(StrId Id, const FuncSet &S, bool InsertEmpty);
   bool mergeFuncSet(FuncSet &Dst, const FuncSet &Src);
   bool findFunctions(llvm::Value *, FuncSet &);
   bool findFunctions(llvm::Value *, FuncSet &,
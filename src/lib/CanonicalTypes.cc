@@ -0,0 +1,112 @@
+/*
+ * Struct types shared by the modules of one LLVMContext
+ *
+ * For licensing details see LICENSE
+ */
+
+#include "CanonicalTypes.h"
+
+using namespace llvm;
+
+void CanonicalTypes::detach(Module *M, Renames &renames) {
+  // nothing left in the context holds a name a module may use, so every
+  // name read here is the one in M
+  for (StructType *T : M->getIdentifiedStructTypes()) {
+    if (!T->hasName())
+      continue;
+    renames.push_back(std::make_pair(T, T->getName().str()));
+    // never in a C identifier, LLVM appends .N should it be taken
+    T->setName(renames.back().second + "#shared");
+  }
+}
+
+void CanonicalTypes::add(const Renames &renames) {
+  // names first, the layouts refer to each other by them
+  for (auto &rename : renames) {
+    Types[rename.first] = Entry{internStr(rename.second), rename.first};
+  }
+  for (auto &rename : renames)
+    canonicalize(rename.first);
+}
+
+void CanonicalTypes::canonicalize(const StructType *T) {
+  Entry &E = Types[T];
+  auto &candidates = ByName[E.name];
+  for (const StructType *C : candidates) {
+    if (isSameLayout(T, C)) {
+      E.canonical = C;
+      return;
+    }
+  }
+  E.canonical = T;
+  candidates.push_back(T);
+}
+
+bool CanonicalTypes::isSameLayout(const StructType *A,
+                                  const StructType *B) const {
+  if (A->isOpaque() != B->isOpaque() || A->isPacked() != B->isPacked() ||
+      A->getNumElements() != B->getNumElements())
+    return false;
+  for (unsigned i = 0; i < A->getNumElements(); ++i) {
+    if (!isEquivalent(A->getElementType(i), B->getElementType(i)))
+      return false;
+  }
+  return true;
+}
+
+// A and B may live in different contexts
+bool CanonicalTypes::isEquivalent(const Type *A, const Type *B) const {
+  if (A == B)
+    return true;
+  if (A->getTypeID() != B->getTypeID())
+    return false;
+
+  switch (A->getTypeID()) {
+  case Type::IntegerTyID:
+    return A->getIntegerBitWidth() == B->getIntegerBitWidth();
+
+  case Type::PointerTyID: {
+    auto *PA = cast<PointerType>(A), *PB = cast<PointerType>(B);
+    return PA->getAddressSpace() == PB->getAddressSpace() &&
+           isEquivalent(PA->getElementType(), PB->getElementType());
+  }
+
+  case Type::ArrayTyID:
+    return A->getArrayNumElements() == B->getArrayNumElements() &&
+           isEquivalent(A->getArrayElementType(), B->getArrayElementType());
+
+  case Type::FixedVectorTyID:
+  case Type::ScalableVectorTyID: {
+    auto *VA = cast<VectorType>(A), *VB = cast<VectorType>(B);
+    return VA->getElementCount() == VB->getElementCount() &&
+           isEquivalent(VA->getElementType(), VB->getElementType());
+  }
+
+  case Type::FunctionTyID: {
+    auto *FA = cast<FunctionType>(A), *FB = cast<FunctionType>(B);
+    if (FA->isVarArg() != FB->isVarArg() ||
+        FA->getNumParams() != FB->getNumParams() ||
+        !isEquivalent(FA->getReturnType(), FB->getReturnType()))
+      return false;
+    for (unsigned i = 0; i < FA->getNumParams(); ++i) {
+      if (!isEquivalent(FA->getParamType(i), FB->getParamType(i)))
+        return false;
+    }
+    return true;
+  }
+
+  case Type::StructTyID: {
+    auto *SA = cast<StructType>(A), *SB = cast<StructType>(B);
+    if (SA->isLiteral() != SB->isLiteral())
+      return false;
+    // named ones by name, which also ends the recursion through pointers
+    if (SA->isLiteral())
+      return isSameLayout(SA, SB);
+    return getName(SA) == getName(SB);
+  }
+
+  default:
+    // float types, void, label, metadata, ...
+    return true;
+  }
+}
@@ -0,0 +1,65 @@
+#ifndef _CANONICAL_TYPES_H
+#define _CANONICAL_TYPES_H
+
+#include <llvm/ADT/DenseMap.h>
+#include <llvm/IR/DerivedTypes.h>
+#include <llvm/IR/Module.h>
+
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "StringInterner.h"
+
+// Struct types of the modules parsed into shared LLVMContexts. A context
+// renames a struct whose name is already taken, so every struct is moved
+// out of the way right after its module is parsed, to the name it had in
+// the module followed by a '#'. Same-named structs of the same layout map
+// to one canonical type, the first loaded, so telling them apart is a
+// pointer comparison.
+//
+// One per analyzer, empty when every module has a context of its own.
+class CanonicalTypes {
+public:
+  // the structs of one parsed module, with their names in it
+  typedef std::vector<std::pair<llvm::StructType *, std::string>> Renames;
+
+  // rename the structs of M out of the way of the modules parsed next into
+  // the same context. only whoever owns the context may call it
+  static void detach(llvm::Module *M, Renames &renames);
+
+  // record the structs of a module, in load order
+  void add(const Renames &renames);
+
+  // the name T has in its module
+  static llvm::StringRef getName(const llvm::StructType *T) {
+    llvm::StringRef name = T->getName();
+    return name.substr(0, name.find('#'));
+  }
+
+  const llvm::StructType *get(const llvm::StructType *T) const {
+    if (Types.empty())
+      return T;
+    auto itr = Types.find(T);
+    return itr == Types.end() ? T : itr->second.canonical;
+  }
+
+private:
+  struct Entry {
+    StrId name;
+    const llvm::StructType *canonical;
+  };
+
+  void canonicalize(const llvm::StructType *T);
+  // element structs are compared by name
+  bool isSameLayout(const llvm::StructType *A,
+                    const llvm::StructType *B) const;
+  bool isEquivalent(const llvm::Type *A, const llvm::Type *B) const;
+
+  llvm::DenseMap<const llvm::StructType *, Entry> Types;
+  // in load order, the canonical type of a name is the first of its layout
+  std::unordered_map<StrId, std::vector<const llvm::StructType *>> ByName;
+};
+
+#endif
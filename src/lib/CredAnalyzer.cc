@@ -3,6 +3,7 @@
 #include <llvm/IR/Constants.h>
 #include <llvm/IR/DebugInfo.h>
 #include <llvm/IR/InstIterator.h>
+#include <llvm/IR/InstVisitor.h>
 #include <llvm/IR/InstrTypes.h>
 #include <llvm/IR/Instructions.h>
 #include <llvm/IR/Module.h>
@@ -12,6 +13,8 @@
 #include <llvm/Support/raw_ostream.h>
 
 #include "CredAnalyzer.h"
+#include "FuncAACache.h"
+#include "FuncHash.h"
 #include "StructAnalyzer.h"
 
 using namespace llvm;
@@ -56,7 +59,7 @@ bool CredAnalyzerPass::doInitialization(Module *M) {
         }
       } else if (auto subPtr = dyn_cast<PointerType>(ele)) {
         if (auto fileType = dyn_cast<StructType>(subPtr->getElementType())) {
-          if (creds.find(fileType->getName()) != creds.end()) {
+          if (creds.find(getStructName(fileType)) != creds.end()) {
             hasCred = true;
             uint64_t offset = stLayout->getElementOffset(index);
             stInfo->credOffset.insert(offset);
@@ -79,7 +82,11 @@ bool CredAnalyzerPass::doInitialization(Module *M) {
   return false;
 }
 
-bool CredAnalyzerPass::doFinalization(Module *M) { return false; }
+bool CredAnalyzerPass::doFinalization(Module *M) {
+  if (Ctx->StripBodies)
+    stripBodies(M, true);
+  return false;
+}
 bool CredAnalyzerPass::doModulePass(Module *M) {
   //   TypeFinder usedStructTypes;
   //   usedStructTypes.run(*M, false);
@@ -87,102 +94,321 @@ bool CredAnalyzerPass::doModulePass(Module *M) {
   //                             ite = usedStructTypes.end();
   //        itr != ite; ++itr) {
   //   }
+  // out of scope, only the bodies later modules may have copies of are
+  // scanned, and the sites are kept for those copies only
+  bool inScope = !Ctx->OutOfScope.count(M);
+  std::vector<Function *> Funcs, Copies;
   for (auto &F : *M) {
-    for (auto i = inst_begin(F), e = inst_end(F); i != e; i++) {
-      Instruction *I = &*i;
-      if (auto CI = dyn_cast<CallInst>(I)) {
-        Function *F = CI->getCalledFunction();
-        if (!F)
+    if (F.empty())
+      continue;
+    // copies of a body scanned in an earlier module reuse its findings
+    if (Ctx->isDuplicateFunc(&F)) {
+      if (inScope)
+        Copies.push_back(&F);
+    } else if (inScope || isDedupCandidate(&F)) {
+      Funcs.push_back(&F);
+    } else {
+      ++Ctx->SkippedFuncs;
+    }
+  }
+
+  // one result buffer per worker, merged once the module is scanned
+  std::vector<SiteBuffer> buffers(Ctx->numWorkers());
+  Ctx->parallelFor(Funcs.size(), [&](size_t i, unsigned worker) {
+    analyzeFunction(Funcs[i], buffers[worker]);
+  });
+
+  for (auto &buf : buffers) {
+    for (auto &rec : buf) {
+      Function *F = rec.CI->getFunction();
+      if (isDedupCandidate(F))
+        uniqueSites[Ctx->FuncHashes[F]].push_back(rec);
+    }
+    if (inScope)
+      mergeSites(M, buf);
+  }
+
+  for (Function *F : Copies) {
+    auto itr = uniqueSites.find(Ctx->FuncHashes[F]);
+    if (itr != uniqueSites.end())
+      mergeSites(M, itr->second);
+  }
+  KA_LOGS(1, "[" << ID << "] reused " << Copies.size()
+                 << " duplicated function bodies\n");
+
+  if (Ctx->StripBodies)
+    stripBodies(M, false);
+  return false;
+}
+
+// resolve the sites of M into IR-free facts and drop the bodies. until the
+// pass finalizes, the first copy of a duplicated body stays, later modules
+// replay its sites
+void CredAnalyzerPass::stripBodies(Module *M, bool final) {
+  auto keep = [&](Function *F) {
+    return !final && Ctx->UnifiedFuncSet.count(F);
+  };
+
+  // sites first, resolving them reads the bodies
+  LiveSites &sites = liveSites[M];
+  LiveSites kept;
+  for (auto &site : sites) {
+    if (keep(site.second->getFunction())) {
+      kept.push_back(site);
+      continue;
+    }
+    site.first->freezeAllocSite(site.second, &Ctx->Caches);
+    site.first->credFreeSite.erase(site.second);
+  }
+  if (kept.empty())
+    liveSites.erase(M);
+  else
+    sites.swap(kept);
+
+  if (final)
+    Ctx->Caches.forgetSites(M);
+  Ctx->Caches.forgetAllocSites(M);
+
+  unsigned stripped = 0;
+  for (Function &F : *M) {
+    if (F.isDeclaration() || keep(&F))
+      continue;
+    // a later copy of the body becomes the first one
+    if (Ctx->UnifiedFuncSet.erase(&F)) {
+      Ctx->UnifiedFuncMap.erase(Ctx->FuncHashes[&F]);
+      uniqueSites.erase(Ctx->FuncHashes[&F]);
+    }
+    Ctx->AA.forget(&F);
+    F.deleteBody();
+    ++stripped;
+  }
+  KA_LOGS(1, "[" << ID << "] stripped " << stripped
+                 << " function bodies\n");
+}
+
+// the sites of a body calling an allocation wrapper depend on the wrappers
+// known, not only on the body
+bool CredAnalyzerPass::callsAllocWrapper(Function *F) const {
+  if (Ctx->Caches.wrappers().empty())
+    return false;
+  for (Instruction &I : instructions(F)) {
+    auto *CI = dyn_cast<CallInst>(&I);
+    Function *Callee = CI ? CI->getCalledFunction() : nullptr;
+    if (Callee && Callee->hasName() &&
+        Ctx->Caches.resolveAllocAPI(Callee) != Callee->getName())
+      return true;
+  }
+  return false;
+}
+
+// scan F, or replay its summary when the same body was analyzed before
+void CredAnalyzerPass::analyzeFunction(Function *F, SiteBuffer &buf) {
+  FuncSummary *S = callsAllocWrapper(F)
+                       ? nullptr
+                       : getSummary(Ctx->Summaries.get(), Ctx->FuncHashes, F);
+  if (!S) {
+    scanFunction(F, buf);
+    return;
+  }
+
+  std::vector<Instruction *> Insts;
+  getSummaryInsts(F, Insts);
+  if (S->HasSites && replaySummary(*S, Insts, buf))
+    return;
+
+  SiteBuffer local;
+  scanFunction(F, local);
+
+  DenseMap<Instruction *, unsigned> Ords;
+  for (unsigned i = 0; i < Insts.size(); ++i)
+    Ords[Insts[i]] = i;
+
+  S->Sites.clear();
+  for (auto &rec : local) {
+    unsigned TI = rec.TI ? Ords[rec.TI] : 0;
+    S->Sites.push_back({rec.kind, Ords[rec.CI], TI, rec.arg, rec.field});
+  }
+  S->HasSites = true;
+  S->Dirty = true;
+
+  buf.insert(buf.end(), local.begin(), local.end());
+}
+
+bool CredAnalyzerPass::replaySummary(const FuncSummary &S,
+                                     const std::vector<Instruction *> &Insts,
+                                     SiteBuffer &buf) {
+  SiteBuffer local;
+  for (auto &site : S.Sites) {
+    if (site.Call >= Insts.size() || site.Type >= Insts.size())
+      return false;
+    CallInst *CI = dyn_cast<CallInst>(Insts[site.Call]);
+    if (!CI || site.Kind > SiteRecord::RetAlloc)
+      return false;
+
+    auto kind = static_cast<SiteRecord::Kind>(site.Kind);
+    Instruction *TI = nullptr;
+    StructType *st = nullptr;
+    if (kind != SiteRecord::ShortArgs) {
+      TI = Insts[site.Type];
+      st = siteStruct(kind, TI);
+      // stale summary, the hash should have prevented this
+      if (!st && kind != SiteRecord::RetAlloc)
+        return false;
+    }
+    local.push_back({kind, CI, TI, st, site.Arg, site.Field});
+  }
+
+  buf.insert(buf.end(), local.begin(), local.end());
+  return true;
+}
+
+// the struct a site is about, read off the instruction recorded with it
+StructType *CredAnalyzerPass::siteStruct(unsigned kind, Instruction *TI) {
+  if (kind == SiteRecord::Alloc) {
+    if (auto *BCI = dyn_cast<BitCastInst>(TI))
+      return getStruct(BCI->getDestTy());
+    // bio_alloc_bioset hands out the struct itself
+    if (auto *CI = dyn_cast<CallInst>(TI))
+      return getStruct(CI->getType());
+  } else if (kind == SiteRecord::CredFree) {
+    if (auto *GEI = dyn_cast<GetElementPtrInst>(TI))
+      return getStruct(GEI->getSourceElementType());
+  }
+  return nullptr;
+}
+
+// only calls and returns carry sites
+class CredAnalyzerPass::SiteScanner : public InstVisitor<SiteScanner> {
+public:
+  SiteScanner(CredAnalyzerPass *Pass_, SiteBuffer &buf_)
+      : Pass(Pass_), buf(buf_) {}
+
+  void visitReturnInst(ReturnInst &RI);
+  void visitCallInst(CallInst &CI);
+
+private:
+  CredAnalyzerPass *Pass;
+  SiteBuffer &buf;
+};
+
+void CredAnalyzerPass::SiteScanner::visitReturnInst(ReturnInst &RI) {
+  // wrappers handing out what an allocation API returned
+  Value *RV = RI.getReturnValue();
+  if (auto *RCI =
+          dyn_cast_or_null<CallInst>(RV ? RV->stripPointerCasts() : nullptr)) {
+    Function *Callee = RCI->getCalledFunction();
+    if (Callee &&
+        AllocAPIs.count(Pass->Ctx->Caches.resolveAllocAPI(Callee)))
+      buf.push_back({SiteRecord::RetAlloc, RCI, &RI, nullptr, 0, 0});
+  }
+}
+
+void CredAnalyzerPass::SiteScanner::visitCallInst(CallInst &CI) {
+  Function *F = CI.getCalledFunction();
+  if (!F)
+    return;
+  auto FName = F->getName();
+
+  for (auto API : Pass->CredAPIs) {
+    // match fput_xxx
+    if (FName.find(API) == llvm::StringRef::npos)
+      continue;
+
+    // backward looking for struct
+    if (CI.arg_size() < 1) {
+      buf.push_back({SiteRecord::ShortArgs, &CI, nullptr, nullptr, 0, 0});
+      continue;
+    }
+    for (unsigned i = 0; i < CI.arg_size(); i++) {
+      auto v = CI.getArgOperand(i);
+      if (auto LI = dyn_cast<LoadInst>(v)) {
+        auto typeName = Pass->handleType(LI->getPointerOperandType());
+        if (Pass->creds.find(typeName) == Pass->creds.end())
           continue;
-        auto FName = F->getName();
-
-        for (auto API : CredAPIs) {
-          // match fput_xxx
-          if (FName.find(API) != llvm::StringRef::npos) {
-            // backward looking for struct
-            if (CI->arg_size() < 1) {
-              KA_LOGS(0, "WARN: " << FName << " has less than 1 args\n");
-              continue;
-            }
-            for (unsigned i = 0; i < CI->arg_size(); i++) {
-              auto v = CI->getArgOperand(i);
-              if (auto LI = dyn_cast<LoadInst>(v)) {
-                auto typeName = handleType(LI->getPointerOperandType());
-                if (creds.find(typeName) == creds.end())
-                  continue;
-
-                // look for the getelement
-                if (auto GEI = dyn_cast<GetElementPtrInst>(LI->getOperand(0))) {
-                  auto *st = getStruct(GEI->getSourceElementType());
-                  unsigned size = GEI->getNumOperands();
-                  assert(size >= 2);
-                  if (auto offset =
-                          dyn_cast<ConstantInt>(GEI->getOperand(size - 1))) {
-
-                    StructInfo *stInfo =
-                        Ctx->structAnalyzer.getStructInfo(st, M);
-
-                    if (!stInfo)
-                      continue;
-
-                    stInfo->isCredObj = true;
-
-                    const StructLayout *stLayout =
-                        stInfo->getDataLayout()->getStructLayout(st);
-                    if (!stLayout)
-                      continue;
-
-                    stInfo->credFreeOffset.insert(
-                        stLayout->getElementOffset(offset->getZExtValue()));
-                    stInfo->credFreeSite.insert(CI);
-                  }
-                }
-              }
-            }
-          }
-        }
 
-        if (AllocAPIs.find(FName) != AllocAPIs.end()) {
-          for (auto *user : cast<Value>(I)->users()) {
-            if (auto *SI = dyn_cast<StoreInst>(user)) {
-              // find its first operand
-              // if (auto *GEI =
-              //         dyn_cast<GetElementPtrInst>(SI->getOperand(1))) {
-              //   if (auto offset = dyn_cast<ConstantInt>(
-              //           GEI->getOperand(GEI->getNumIndices()))) {
-              //     // find the GEI, check if the struct and it's offset is
-              //     in
-              //     // the
-              //     unsigned offset_val = offset->getZExtValue();
-              //     StringRef name = handleType(GEI->getSourceElementType());
-              //     if (Ctx->ElementOffset.find(name) !=
-              //         Ctx->ElementOffset.end()) {
-              //       if (Ctx->ElementOffset[name].find(offset_val) !=
-              //           Ctx->ElementOffset[name].end()) {
-              //         Ctx->Allocations.insert(CI);
-              //       }
-              //     }
-              //   }
-              // }
-            } else if (auto *BCI = dyn_cast<BitCastInst>(user)) {
-              auto st = getStruct(BCI->getDestTy());
-              if (!st)
-                continue;
-              StructInfo *stInfo = Ctx->structAnalyzer.getStructInfo(st, M);
-
-              // if (stInfo && stInfo->isCredObj) {
-              if (stInfo) {
-                // io_req is not a conventional allocation
-                stInfo->allocSite.insert(CI);
-              }
-            }
+        // look for the getelement
+        if (auto GEI = dyn_cast<GetElementPtrInst>(LI->getOperand(0))) {
+          auto *st = Pass->siteStruct(SiteRecord::CredFree, GEI);
+          unsigned size = GEI->getNumOperands();
+          assert(size >= 2);
+          if (auto offset = dyn_cast<ConstantInt>(GEI->getOperand(size - 1))) {
+            buf.push_back({SiteRecord::CredFree, &CI, GEI, st, i,
+                           offset->getZExtValue()});
           }
         }
       }
     }
   }
 
-  return false;
+  if (AllocAPIs.count(Pass->Ctx->Caches.resolveAllocAPI(F))) {
+    for (auto *user : CI.users()) {
+      if (auto *BCI = dyn_cast<BitCastInst>(user)) {
+        auto st = Pass->siteStruct(SiteRecord::Alloc, BCI);
+        if (!st)
+          continue;
+        buf.push_back({SiteRecord::Alloc, &CI, BCI, st, 0, 0});
+      }
+    }
+    if (pool_alloc.count(FName)) {
+      if (auto *st = Pass->siteStruct(SiteRecord::Alloc, &CI))
+        buf.push_back({SiteRecord::Alloc, &CI, &CI, st, 0, 0});
+    }
+  }
+}
+
+void CredAnalyzerPass::scanFunction(Function *F, SiteBuffer &buf) {
+  SiteScanner Scanner(this, buf);
+  Scanner.visit(F);
+}
+
+void CredAnalyzerPass::mergeSites(Module *M, const SiteBuffer &buf) {
+  for (auto &rec : buf) {
+    if (rec.kind == SiteRecord::ShortArgs) {
+      KA_LOGS(0, "WARN: " << rec.CI->getCalledFunction()->getName()
+                          << " has less than 1 args\n");
+      continue;
+    }
+
+    if (rec.kind == SiteRecord::RetAlloc) {
+      Function *Callee = rec.CI->getCalledFunction();
+      Ctx->RetAllocs[rec.TI->getFunction()] =
+          internStr(CacheInventory::getWrapperName(Callee));
+      continue;
+    }
+
+    StructType *st = cast_or_null<StructType>(rec.ty);
+    StructInfo *stInfo = Ctx->structAnalyzer.getStructInfo(st, M);
+    if (!stInfo)
+      continue;
+
+    // attribute the struct to every module a (possibly shared) site is in
+    Ctx->structModuleMap[internStr(stInfo->name)].insert(M);
+
+    // a site is tracked in the module its body is in, also when only the
+    // copies replaying it are in scope
+    bool known = stInfo->allocSite.count(rec.CI) ||
+                 stInfo->credFreeSite.count(rec.CI);
+    if (Ctx->StripBodies && !known)
+      liveSites[rec.CI->getModule()].push_back(
+          std::make_pair(stInfo, rec.CI));
+
+    if (rec.kind == SiteRecord::Alloc) {
+      // io_req is not a conventional allocation
+      stInfo->allocSite.insert(rec.CI);
+      // every copy counts for the module holding it
+      stInfo->siteModules[rec.CI].push_back(M);
+      continue;
+    }
+
+    stInfo->isCredObj = true;
+
+    const StructLayout *stLayout = stInfo->getDataLayout()->getStructLayout(st);
+    if (!stLayout)
+      continue;
+
+    stInfo->credFreeOffset.insert(stLayout->getElementOffset(rec.field));
+    stInfo->credFreeSite.insert(rec.CI);
+  }
 }
 
 StringRef CredAnalyzerPass::handleType(Type *ty) {
@@ -200,7 +426,7 @@ StringRef CredAnalyzerPass::handleType(Type *ty) {
 
   if (ty->isStructTy()) {
     StructType *ST = dyn_cast<StructType>(ty);
-    StringRef stname = ST->getName();
+    StringRef stname = getStructName(ST);
 
     return stname;
     // substitude
@@ -249,7 +475,7 @@ bool CredAnalyzerPass::findCred(StructType *st) {
     } else if (isa<PointerType>(ele)) {
       if (auto fileType =
               dyn_cast<StructType>(cast<PointerType>(ele)->getElementType())) {
-        if (creds.find(fileType->getName()) != creds.end()) {
+        if (creds.find(getStructName(fileType)) != creds.end()) {
           return true;
         }
       }
@@ -15,6 +15,38 @@ private:
       "struct.cred",
   };
 
+  // findings of one function, resolved against StructInfo when merged so the
+  // scan itself only reads IR and can run on any worker
+  struct SiteRecord {
+    enum Kind { Alloc, CredFree, ShortArgs, RetAlloc } kind;
+    CallInst *CI;
+    // instruction ty is read off, the return instruction for RetAlloc
+    Instruction *TI;
+    Type *ty;
+    unsigned arg;
+    uint64_t field;
+  };
+  typedef std::vector<SiteRecord> SiteBuffer;
+  class SiteScanner;
+
+  void analyzeFunction(Function *F, SiteBuffer &buf);
+  bool callsAllocWrapper(Function *F) const;
+  void scanFunction(Function *F, SiteBuffer &buf);
+  bool replaySummary(const FuncSummary &S,
+                     const std::vector<Instruction *> &Insts,
+                     SiteBuffer &buf);
+  void mergeSites(Module *M, const SiteBuffer &buf);
+  StructType *siteStruct(unsigned kind, Instruction *TI);
+
+  // findings of each unique dedup-candidate body, keyed by body hash
+  std::unordered_map<size_t, SiteBuffer> uniqueSites;
+
+  // with StripBodies, the sites recorded in StructInfo whose bodies are
+  // still there, per module
+  typedef std::vector<std::pair<StructInfo *, CallInst *>> LiveSites;
+  std::unordered_map<Module *, LiveSites> liveSites;
+  void stripBodies(Module *M, bool final);
+
 public:
   CredAnalyzerPass(GlobalContext *Ctx_)
       : IterativeModulePass(Ctx_, "CredAnalysis") {}
@@ -0,0 +1,93 @@
+/*
+ * Per-function alias analysis cache
+ *
+ * For licensing details see LICENSE
+ */
+
+#include <llvm/ADT/Triple.h>
+#include <llvm/IR/Module.h>
+
+#include "FuncAACache.h"
+
+using namespace llvm;
+
+const size_t FuncAACache::DefaultCapacity;
+
+FuncAACache::~FuncAACache() { clear(); }
+
+void FuncAACache::setCapacity(size_t Capacity_) {
+  Capacity = Capacity_;
+  while (!LRU.empty() && Size > Capacity)
+    evict(std::prev(LRU.end()));
+}
+
+AAResults &FuncAACache::get(Function *F) {
+  auto itr = Index.find(F);
+  if (itr != Index.end()) {
+    LRU.splice(LRU.begin(), LRU, itr->second);
+    ++Hits;
+    return *itr->second->AA;
+  }
+
+  // make room first, the entry asked for always stays
+  size_t size = F->getInstructionCount();
+  while (!LRU.empty() && Size + size > Capacity)
+    evict(std::prev(LRU.end()));
+
+  const Module *M = F->getParent();
+  std::unique_ptr<TargetLibraryInfoImpl> &Lib = Libs[M];
+  if (!Lib)
+    Lib.reset(new TargetLibraryInfoImpl(Triple(M->getTargetTriple())));
+
+  LRU.emplace_front();
+  Entry &E = LRU.front();
+  E.F = F;
+  E.Size = size;
+  E.TLI.reset(new TargetLibraryInfo(*Lib, F));
+  E.AC.reset(new AssumptionCache(*F));
+  E.DT.reset(new DominatorTree(*F));
+  E.BasicAA.reset(new BasicAAResult(M->getDataLayout(), *F, *E.TLI, *E.AC,
+                                    E.DT.get()));
+  E.TBAA.reset(new TypeBasedAAResult());
+  E.AA.reset(new AAResults(*E.TLI));
+  E.AA->addAAResult(*E.BasicAA);
+  E.AA->addAAResult(*E.TBAA);
+
+  Index[F] = LRU.begin();
+  Size += size;
+  ++Built;
+  return *E.AA;
+}
+
+void FuncAACache::evict(EntryRef E) {
+  Index.erase(E->F);
+  Size -= E->Size;
+  LRU.erase(E);
+  ++Evicted;
+}
+
+void FuncAACache::forget(const Function *F) {
+  auto itr = Index.find(F);
+  if (itr == Index.end())
+    return;
+  Size -= itr->second->Size;
+  LRU.erase(itr->second);
+  Index.erase(itr);
+}
+
+void FuncAACache::forgetModule(const Module *M) {
+  for (auto itr = LRU.begin(); itr != LRU.end();) {
+    auto next = std::next(itr);
+    if (itr->F->getParent() == M)
+      forget(itr->F);
+    itr = next;
+  }
+  Libs.erase(M);
+}
+
+void FuncAACache::clear() {
+  LRU.clear();
+  Index.clear();
+  Libs.clear();
+  Size = 0;
+}
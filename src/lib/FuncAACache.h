@@ -0,0 +1,76 @@
+#ifndef _FUNC_AA_CACHE_H
+#define _FUNC_AA_CACHE_H
+
+#include <llvm/ADT/DenseMap.h>
+#include <llvm/Analysis/AliasAnalysis.h>
+#include <llvm/Analysis/AssumptionCache.h>
+#include <llvm/Analysis/BasicAliasAnalysis.h>
+#include <llvm/Analysis/TargetLibraryInfo.h>
+#include <llvm/Analysis/TypeBasedAliasAnalysis.h>
+#include <llvm/IR/Dominators.h>
+#include <llvm/IR/Function.h>
+
+#include <list>
+#include <memory>
+
+// LLVM alias analysis (BasicAA, then TBAA) of single functions, built the
+// first time something asks about a function and kept in LRU order. The
+// functions kept may have up to Capacity instructions in all, the least
+// recently asked about go first; a capacity of 0 turns it off. Most
+// functions are never asked about and cost nothing.
+//
+// An entry holds on to its function's body, forget it before the body is
+// deleted. Not thread safe.
+class FuncAACache {
+public:
+  static const size_t DefaultCapacity = 1 << 18;
+
+  explicit FuncAACache(size_t Capacity_ = 0) : Capacity(Capacity_) {}
+  ~FuncAACache();
+
+  bool enabled() const { return Capacity != 0; }
+  void setCapacity(size_t Capacity_);
+
+  // the analysis of F, valid until the next call to get
+  llvm::AAResults &get(llvm::Function *F);
+
+  void forget(const llvm::Function *F);
+  void forgetModule(const llvm::Module *M);
+  void clear();
+
+  unsigned built() const { return Built; }
+  unsigned hits() const { return Hits; }
+  unsigned evicted() const { return Evicted; }
+
+private:
+  // each after what it refers to, so AA is destroyed first
+  struct Entry {
+    const llvm::Function *F;
+    size_t Size;
+    std::unique_ptr<llvm::TargetLibraryInfo> TLI;
+    std::unique_ptr<llvm::AssumptionCache> AC;
+    std::unique_ptr<llvm::DominatorTree> DT;
+    std::unique_ptr<llvm::BasicAAResult> BasicAA;
+    std::unique_ptr<llvm::TypeBasedAAResult> TBAA;
+    std::unique_ptr<llvm::AAResults> AA;
+  };
+  typedef std::list<Entry>::iterator EntryRef;
+
+  void evict(EntryRef E);
+
+  size_t Capacity;
+  size_t Size = 0;
+  // most recently used first
+  std::list<Entry> LRU;
+  llvm::DenseMap<const llvm::Function *, EntryRef> Index;
+  // library functions by triple, shared by the entries of a module
+  llvm::DenseMap<const llvm::Module *,
+                 std::unique_ptr<llvm::TargetLibraryInfoImpl>>
+      Libs;
+
+  unsigned Built = 0;
+  unsigned Hits = 0;
+  unsigned Evicted = 0;
+};
+
+#endif
@@ -0,0 +1,218 @@
+/*
+ * Structural function body hashing
+ *
+ * For licensing details see LICENSE
+ */
+
+#include <llvm/ADT/DenseMap.h>
+#include <llvm/ADT/SmallString.h>
+#include <llvm/IR/Constants.h>
+#include <llvm/IR/InlineAsm.h>
+#include <llvm/IR/Instructions.h>
+#include <llvm/IR/IntrinsicInst.h>
+#include <llvm/Support/Path.h>
+#include <llvm/Support/raw_ostream.h>
+#include <llvm/Support/xxhash.h>
+
+#include "Annotation.h"
+#include "FuncHash.h"
+
+using namespace llvm;
+
+namespace {
+
+// Serialize everything the hash depends on into a flat buffer and hash it
+// once. xxHash keeps the value stable across runs, so it can be persisted.
+class BodyHasher {
+public:
+  uint64_t run(const Function *F);
+
+private:
+  void addInt(uint64_t V) {
+    Buf.append(reinterpret_cast<const char *>(&V),
+               reinterpret_cast<const char *>(&V) + sizeof(V));
+  }
+  void addStr(StringRef S) {
+    addInt(S.size());
+    Buf.append(S.begin(), S.end());
+  }
+  void addType(Type *Ty);
+  void addValue(const Value *V);
+  void addInst(const Instruction *I);
+
+  const Module *M = nullptr;
+  DenseMap<const Value *, unsigned> Nums;
+  SmallString<4096> Buf;
+};
+
+} // namespace
+
+void BodyHasher::addType(Type *Ty) {
+  addInt(Ty->getTypeID());
+
+  if (auto *IT = dyn_cast<IntegerType>(Ty)) {
+    addInt(IT->getBitWidth());
+  } else if (auto *PT = dyn_cast<PointerType>(Ty)) {
+    addInt(PT->getAddressSpace());
+    Type *ElTy = PT->getElementType();
+    // named structs are identified by name, never expanded
+    if (auto *ST = dyn_cast<StructType>(ElTy)) {
+      if (!ST->isLiteral()) {
+        addStr(getScopeName(ST, M));
+        return;
+      }
+    }
+    addType(ElTy);
+  } else if (auto *ST = dyn_cast<StructType>(Ty)) {
+    if (!ST->isLiteral()) {
+      addStr(getScopeName(ST, M));
+      return;
+    }
+    addInt(ST->getNumElements());
+    for (Type *ElTy : ST->elements())
+      addType(ElTy);
+  } else if (auto *AT = dyn_cast<ArrayType>(Ty)) {
+    addInt(AT->getNumElements());
+    addType(AT->getElementType());
+  } else if (auto *VT = dyn_cast<FixedVectorType>(Ty)) {
+    addInt(VT->getNumElements());
+    addType(VT->getElementType());
+  } else if (auto *FT = dyn_cast<FunctionType>(Ty)) {
+    addInt(FT->isVarArg());
+    addType(FT->getReturnType());
+    addInt(FT->getNumParams());
+    for (Type *ParamTy : FT->params())
+      addType(ParamTy);
+  }
+}
+
+void BodyHasher::addValue(const Value *V) {
+  addInt(V->getValueID());
+
+  auto itr = Nums.find(V);
+  if (itr != Nums.end()) {
+    addInt(itr->second);
+    return;
+  }
+
+  // a static inline calling another one, like list_add calling
+  // __list_add, has a copy of the callee in every module it is in. the
+  // callee's name stands for it, as the caller's own name does
+  if (auto *CF = dyn_cast<Function>(V)) {
+    if (CF->hasLocalLinkage()) {
+      addStr(CF->getName());
+      addType(CF->getFunctionType());
+      return;
+    }
+  }
+  if (auto *GV = dyn_cast<GlobalValue>(V)) {
+    // module-private data keeps copies from different modules apart
+    addStr(getScopeName(GV));
+    return;
+  }
+
+  addType(V->getType());
+
+  if (auto *CI = dyn_cast<ConstantInt>(V)) {
+    const APInt &Val = CI->getValue();
+    for (unsigned i = 0; i < Val.getNumWords(); ++i)
+      addInt(Val.getRawData()[i]);
+  } else if (auto *CFP = dyn_cast<ConstantFP>(V)) {
+    APInt Bits = CFP->getValueAPF().bitcastToAPInt();
+    for (unsigned i = 0; i < Bits.getNumWords(); ++i)
+      addInt(Bits.getRawData()[i]);
+  } else if (auto *CDS = dyn_cast<ConstantDataSequential>(V)) {
+    addStr(CDS->getRawDataValues());
+  } else if (auto *CE = dyn_cast<ConstantExpr>(V)) {
+    addInt(CE->getOpcode());
+    if (CE->isCompare())
+      addInt(CE->getPredicate());
+    for (const Value *Op : CE->operand_values())
+      addValue(Op);
+  } else if (auto *CA = dyn_cast<ConstantAggregate>(V)) {
+    for (const Value *Op : CA->operand_values())
+      addValue(Op);
+  } else if (auto *IA = dyn_cast<InlineAsm>(V)) {
+    addStr(IA->getAsmString());
+    addStr(IA->getConstraintString());
+  }
+  // null, undef, zeroinitializer and metadata are covered by id and type
+}
+
+void BodyHasher::addInst(const Instruction *I) {
+  addInt(I->getOpcode());
+  addType(I->getType());
+  addInt(I->getNumOperands());
+  for (const Value *Op : I->operand_values())
+    addValue(Op);
+
+  if (auto *Cmp = dyn_cast<CmpInst>(I)) {
+    addInt(Cmp->getPredicate());
+  } else if (auto *GEP = dyn_cast<GetElementPtrInst>(I)) {
+    addInt(GEP->isInBounds());
+    addType(GEP->getSourceElementType());
+  } else if (auto *AI = dyn_cast<AllocaInst>(I)) {
+    addType(AI->getAllocatedType());
+  } else if (auto *LI = dyn_cast<LoadInst>(I)) {
+    addInt(LI->isVolatile());
+  } else if (auto *SI = dyn_cast<StoreInst>(I)) {
+    addInt(SI->isVolatile());
+  } else if (auto *PN = dyn_cast<PHINode>(I)) {
+    for (const BasicBlock *BB : PN->blocks())
+      addValue(BB);
+  }
+}
+
+uint64_t BodyHasher::run(const Function *F) {
+  M = F->getParent();
+
+  // number arguments, blocks and instructions first so forward references
+  // (phis, branches) hash the same in every copy
+  unsigned Num = 0;
+  for (const Argument &A : F->args())
+    Nums[&A] = Num++;
+  for (const BasicBlock &BB : *F) {
+    Nums[&BB] = Num++;
+    for (const Instruction &I : BB) {
+      if (!isa<DbgInfoIntrinsic>(I))
+        Nums[&I] = Num++;
+    }
+  }
+
+  addStr(F->getName());
+  addType(F->getFunctionType());
+  for (const BasicBlock &BB : *F) {
+    addInt(BB.size());
+    for (const Instruction &I : BB) {
+      if (!isa<DbgInfoIntrinsic>(I))
+        addInst(&I);
+    }
+  }
+
+  uint64_t H = xxHash64(Buf.str());
+  // keep clear of the DenseMap empty and tombstone keys
+  if (H >= ~0ULL - 1)
+    H -= 2;
+  return H;
+}
+
+uint64_t hashFunctionBody(const Function *F) {
+  BodyHasher Hasher;
+  return Hasher.run(F);
+}
+
+uint64_t hashFunctionNames(const Function *F) {
+  SmallString<4096> Buf;
+  raw_svector_ostream OS(Buf);
+  OS << sys::path::stem(F->getParent()->getModuleIdentifier()) << '\0';
+  for (const BasicBlock &BB : *F) {
+    for (const Instruction &I : BB) {
+      if (isa<DbgInfoIntrinsic>(I))
+        continue;
+      OS << I.getName() << '\0';
+      I.getDebugLoc().print(OS);
+      OS << '\0';
+    }
+  }
+  return xxHash64(Buf.str());
+}
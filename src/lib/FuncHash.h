@@ -0,0 +1,27 @@
+#ifndef _FUNC_HASH_H
+#define _FUNC_HASH_H
+
+#include <llvm/IR/Function.h>
+
+#include <cstdint>
+
+// Structural hash of a function body. Two functions hash alike when they
+// have the same name and signature and their instructions agree on opcode,
+// types, constants, referenced globals and operand wiring. Value names are
+// ignored and struct types are compared by their scope name, so copies of
+// a header inline function living in different modules (and contexts)
+// collide, while module-private data they touch keeps them apart. Static
+// functions they call are told apart by name only.
+uint64_t hashFunctionBody(const llvm::Function *F);
+
+// Hash of what the annotation ids of F read beyond its body hash: the
+// module stem, the value names and the debug locations.
+uint64_t hashFunctionNames(const llvm::Function *F);
+
+// only bodies that may be duplicated across modules are worth hashing
+static inline bool isDedupCandidate(const llvm::Function *F) {
+  return !F->isDeclaration() &&
+         (F->hasLocalLinkage() || F->hasLinkOnceLinkage());
+}
+
+#endif
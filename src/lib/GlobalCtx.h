@@ -4,6 +4,7 @@
 #include <llvm/ADT/DenseMap.h>
 #include <llvm/ADT/SmallPtrSet.h>
 #include <llvm/ADT/StringExtras.h>
+#include <llvm/ADT/StringSet.h>
 #include <llvm/Analysis/AliasAnalysis.h>
 #include <llvm/IR/DebugInfo.h>
 #include <llvm/IR/Instructions.h>
@@ -15,28 +16,37 @@
 #include <fstream>
 #include <iostream>
 #include <map>
+#include <memory>
 #include <set>
 #include <sstream>
 #include <string>
 #include <unordered_map>
 #include <unordered_set>
 
+#include "Andersen.h"
+#include "CanonicalTypes.h"
 #include "Common.h"
+#include "FuncAACache.h"
+#include "StringInterner.h"
 #include "StructAnalyzer.h"
+#include "SummaryCache.h"
+#include "ThreadPool.h"
 
 using namespace llvm;
 using namespace std;
 
+// names used as map keys (functions, globals, structs, annotation ids) are
+// interned, see StringInterner.h
 typedef std::vector<std::pair<llvm::Module *, llvm::StringRef>> ModuleList;
 typedef std::unordered_map<llvm::Module *, llvm::StringRef> ModuleMap;
-typedef std::unordered_map<std::string, llvm::Function *> FuncMap;
-typedef std::unordered_map<std::string, llvm::GlobalVariable *> GObjMap;
+typedef std::unordered_map<StrId, llvm::Function *> FuncMap;
+typedef std::unordered_map<StrId, llvm::GlobalVariable *> GObjMap;
 
 /****************** Call Graph **************/
-typedef unordered_map<string, llvm::Function *> NameFuncMap;
+typedef unordered_map<StrId, llvm::Function *> NameFuncMap;
 typedef llvm::SmallPtrSet<llvm::CallInst *, 8> CallInstSet;
 typedef llvm::SmallPtrSet<llvm::Function *, 32> FuncSet;
-typedef std::unordered_map<std::string, FuncSet> FuncPtrMap;
+typedef std::unordered_map<StrId, FuncSet> FuncPtrMap;
 typedef llvm::DenseMap<llvm::Function *, CallInstSet> CallerMap;
 typedef llvm::DenseMap<llvm::CallInst *, FuncSet> CalleeMap;
 /****************** end Call Graph **************/
@@ -44,7 +54,6 @@ typedef llvm::DenseMap<llvm::CallInst *, FuncSet> CalleeMap;
 /****************** Alias **************/
 typedef DenseMap<Value *, SmallPtrSet<Value *, 16>> PointerAnalysisMap;
 typedef unordered_map<Function *, PointerAnalysisMap> FuncPointerAnalysisMap;
-typedef unordered_map<Function *, AAResults *> FuncAAResultsMap;
 /****************** end Alias **************/
 
 /****************** mbuf Leak API **************/
@@ -53,21 +62,21 @@ typedef unordered_map<Function *, AAResults *> FuncAAResultsMap;
 
 /****************** Flexible Structural Object Identification **************/
 
-typedef std::unordered_map<std::string, StructInfo *> LeakStructMap;
+typedef std::unordered_map<StrId, StructInfo *> LeakStructMap;
 
 typedef llvm::SmallPtrSet<llvm::Instruction *, 32> InstSet;
-typedef std::unordered_map<std::string, InstSet> AllocInstMap;
-typedef std::unordered_map<std::string, InstSet> LeakInstMap;
-typedef std::unordered_map<std::string, FuncSet> AllocSyscallMap;
-typedef std::unordered_map<std::string, FuncSet> LeakSyscallMap;
+typedef std::unordered_map<StrId, InstSet> AllocInstMap;
+typedef std::unordered_map<StrId, InstSet> LeakInstMap;
+typedef std::unordered_map<StrId, FuncSet> AllocSyscallMap;
+typedef std::unordered_map<StrId, FuncSet> LeakSyscallMap;
 
 typedef llvm::SmallPtrSet<llvm::Module *, 32> ModuleSet;
-typedef std::unordered_map<std::string, ModuleSet> StructModuleMap;
+typedef std::unordered_map<StrId, ModuleSet> StructModuleMap;
 
 typedef llvm::SmallPtrSet<llvm::StructType *, 32> StructTypeSet;
 typedef llvm::DenseMap<llvm::Module *, StructTypeSet> ModuleStructMap;
 
-typedef std::unordered_map<std::string, InstSet> LeakerList;
+typedef std::unordered_map<StrId, InstSet> LeakerList;
 
 typedef std::unordered_map<unsigned, InstSet> StoreMap;
 
@@ -75,14 +84,15 @@ typedef std::unordered_map<unsigned, InstSet> StoreMap;
 
 /****************** Flexible Structural Object Evaluation **************/
 
-typedef std::unordered_map<std::string, std::vector<unsigned>> LeakerLayout;
+typedef std::unordered_map<StrId, std::vector<unsigned>> LeakerLayout;
 // typedef llvm::DenseMap<llvm::Value*, unsigned> SliceMap;
 typedef llvm::SmallPtrSet<llvm::ICmpInst *, 32> ICmpInstSet;
-typedef std::unordered_map<std::string, ICmpInstSet> LeakerICmpMap;
+typedef std::unordered_map<StrId, ICmpInstSet> LeakerICmpMap;
 
 /**************** End Flexible Structural Object Evaluation ************/
 
-static std::set<llvm::StringRef> AllocAPIs = {
+// hashed, every call is looked up
+static const llvm::StringSet<> AllocAPIs = {
     "__kmalloc",
     "__kmalloc_node",
     "kmalloc",
@@ -99,6 +109,19 @@ static std::set<llvm::StringRef> AllocAPIs = {
     "kmem_cache_alloc_node",
     "kmem_cache_zalloc",
     "sk_alloc",
+    "mempool_alloc",
+    "bio_alloc_bioset",
+    "__alloc_percpu",
+    "__alloc_percpu_gfp",
+};
+
+// an skb allocation, the data buffer of which comes from kmalloc
+struct SkbAlloc {
+  // scope name of the calling function
+  std::string func;
+  llvm::StringRef api;
+  // size asked for, CacheInfo::Unknown if not a constant
+  uint64_t size;
 };
 
 class GlobalContext {
@@ -128,6 +151,29 @@ public:
   // StructAnalyzer
   StructAnalyzer structAnalyzer;
 
+  // workers for function-granularity tasks inside a module
+  std::unique_ptr<WorkStealingPool> Pool;
+
+  unsigned numWorkers() const { return Pool ? Pool->size() : 1; }
+
+  void parallelFor(size_t N, const WorkStealingPool::TaskFn &Fn) const {
+    if (Pool) {
+      Pool->parallelFor(N, Fn);
+      return;
+    }
+    for (size_t i = 0; i < N; ++i)
+      Fn(i, 0);
+  }
+
+  // skb allocations of the loaded modules
+  std::vector<SkbAlloc> SkbAllocs;
+
+  // every kmem_cache created in the loaded modules
+  CacheInventory Caches;
+
+  // the structs of the modules in shared LLVMContexts
+  CanonicalTypes Types;
+
   // Map global object name to object definition
   GObjMap Gobjs;
 
@@ -159,9 +205,41 @@ public:
   DenseMap<size_t, Function *> UnifiedFuncMap;
   set<Function *> UnifiedFuncSet;
 
+  // body hash of every function that may be duplicated across modules,
+  // of every defined function when summaries are cached
+  DenseMap<Function *, size_t> FuncHashes;
+
+  // persistent per-function summaries, keyed by body hash, possibly
+  // shared with the analyzers of other architectures
+  std::shared_ptr<SummaryCache> Summaries;
+
+  // drop function bodies once CredAnalysis has summarized their sites
+  bool StripBodies = false;
+
+  // functions returning what an allocation API returned, and that API
+  DenseMap<Function *, StrId> RetAllocs;
+
+  // modules outside the --include/--exclude globs, loaded for their layouts
+  // and caches. their sites are not collected
+  std::unordered_set<const Module *> OutOfScope;
+  // bodies of those modules the site scan skipped
+  unsigned SkippedFuncs = 0;
+
+  // the first loaded copy of F's body, F itself if it is unique
+  Function *getUnifiedFunc(Function *F) {
+    auto itr = FuncHashes.find(F);
+    if (itr == FuncHashes.end())
+      return F;
+    Function *U = UnifiedFuncMap.lookup(itr->second);
+    return U ? U : F;
+  }
+
+  bool isDuplicateFunc(Function *F) { return getUnifiedFunc(F) != F; }
+
   /****** Alias Analysis *******/
   FuncPointerAnalysisMap FuncPAResults;
-  FuncAAResultsMap FuncAAResults;
+  // LLVM's alias analysis of single functions, with --local-aa
+  FuncAACache AA;
 
   /****** Leak struct **********/
   LeakStructMap leakStructMap;
@@ -202,8 +280,8 @@ public:
   LeakerICmpMap leakerICmpMap;
   /**************** End Flexible Structural Object Evaluation ************/
 
-  // A factory object that knows how to manage AndersNodes
-  // AndersNodeFactory nodeFactory;
+  // points-to sets of the loaded modules, once KAnalyzer::PointsTo ran
+  std::unique_ptr<Andersen> PointsTo;
 
   ModuleList Modules;
 
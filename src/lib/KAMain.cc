@@ -17,6 +17,7 @@
 #include <llvm/IRReader/IRReader.h>
 #include <llvm/Support/FileSystem.h>
 #include <llvm/Support/ManagedStatic.h>
+#include <llvm/Support/MemoryBuffer.h>
 #include <llvm/Support/Path.h>
 #include <llvm/Support/PrettyStackTrace.h>
 #include <llvm/Support/Signals.h>
@@ -24,112 +25,223 @@
 #include <llvm/Support/SystemUtils.h>
 #include <llvm/Support/ToolOutputFile.h>
 
+#include <map>
 #include <memory>
 #include <sstream>
 #include <sys/resource.h>
 #include <vector>
 
-#include "CallGraph.h"
-#include "CredAnalyzer.h"
-#include "GlobalCtx.h"
+#include "KAnalyzer.h"
 
 using namespace llvm;
 
-cl::list<std::string> InputFilenames(cl::Positional, cl::OneOrMore,
+cl::list<std::string> InputFilenames(cl::Positional, cl::ZeroOrMore,
                                      cl::desc("<input bitcode files>"));
 
-cl::opt<unsigned>
-    VerboseLevel("debug-verbose",
-                 cl::desc("Print information about actions taken"),
-                 cl::init(0));
+cl::list<std::string>
+    Archs("arch",
+          cl::desc("<name>=<file>: analyze the inputs listed in <file>, one "
+                   "per line, as the build for one architecture. Repeat for "
+                   "every architecture, the struct report then gets a cache "
+                   "column per architecture"),
+          cl::ZeroOrMore);
 
 cl::opt<bool> DumpAll("dump", cl::desc("Dump all"), cl::NotHidden,
                       cl::init(true));
 
+cl::opt<bool> DumpCaches("dump-caches",
+                         cl::desc("Print every kmem_cache created and where "
+                                  "it is stored"),
+                         cl::init(false));
+
+cl::opt<bool> Usercopy("usercopy",
+                       cl::desc("Append the usercopy window (offset,size) "
+                                "of the cache to every struct"),
+                       cl::init(false));
+
+cl::opt<bool> Embedded("embedded",
+                       cl::desc("Also print every cache each struct may live "
+                                "in, embedded in other structs, with its "
+                                "offsets"),
+                       cl::init(false));
+
+cl::opt<bool> Unions("unions",
+                     cl::desc("Also print the unions in every cache object "
+                              "and the members overlapping in them"),
+                     cl::init(false));
+
+cl::list<std::string>
+    Include("include",
+            cl::desc("Only collect sites in, and report on, the modules whose "
+                     "input path or source_filename matches this glob. "
+                     "Repeatable"),
+            cl::ZeroOrMore);
+
+cl::list<std::string>
+    Exclude("exclude",
+            cl::desc("Skip the sites of the modules whose input path or "
+                     "source_filename matches this glob. Repeatable"),
+            cl::ZeroOrMore);
+
+cl::opt<std::string>
+    SaveCore("save-core",
+             cl::desc("Save the struct report, the cache inventory and the "
+                      "allocation wrappers of the inputs, the core kernel, "
+                      "to this file"),
+             cl::init(""));
+
+cl::opt<std::string>
+    Core("core",
+         cl::desc("Analyze the inputs, loadable modules, against the core "
+                  "kernel summary saved to this file by --save-core"),
+         cl::init(""));
+
 cl::opt<bool>
-    IgnoreAllocation("ignore-allocation",
-                     cl::desc("Ignore the allocation of cred objects"),
-                     cl::NotHidden, cl::init(false));
+    Subsystems("subsystems",
+               cl::desc("Also print, per subsystem, the allocated structs, "
+                        "the sites per cache and the share of dedicated "
+                        "caches"),
+               cl::init(false));
 
-GlobalContext GlobalCtx;
+cl::opt<bool> Skb("skb",
+                  cl::desc("Also print every skb allocation with the "
+                           "kmalloc cache of its data buffer"),
+                  cl::init(false));
 
-void IterativeModulePass::run(ModuleList &modules) {
+cl::opt<bool> Percpu("percpu",
+                     cl::desc("Also print every struct allocated per CPU "
+                              "with the space it takes in the per-CPU "
+                              "chunks"),
+                     cl::init(false));
 
-  ModuleList::iterator i, e;
+cl::opt<bool> PointsTo("points-to",
+                       cl::desc("Resolve the caches of the allocation sites "
+                                "whose cache pointer is passed around, "
+                                "with a whole-program points-to analysis"),
+                       cl::init(false));
 
-  KA_LOGS(1, "[" << ID << "] Initializing " << modules.size() << " modules.\n");
-  bool again = true;
-  while (again) {
-    again = false;
-    for (i = modules.begin(), e = modules.end(); i != e; ++i) {
-      KA_LOGS(1, "[" << i->second << "]\n");
-      again |= doInitialization(i->first);
-    }
-  }
+extern cl::opt<bool> IgnoreAllocation;
 
-  KA_LOGS(1, "[" << ID << "] Processing " << modules.size() << " modules.\n");
-  unsigned iter = 0, changed = 1;
-  while (changed) {
-    ++iter;
-    changed = 0;
-    for (i = modules.begin(), e = modules.end(); i != e; ++i) {
-      KA_LOGS(1, "[" << ID << " / " << iter << "] ");
-      // FIXME: Seems the module name is incorrect, and perhaps it's a bug.
-      KA_LOGS(1, "[" << i->second << "]\n");
-
-      bool ret = doModulePass(i->first);
-      if (ret) {
-        ++changed;
-        KA_LOGS(1, "\t [CHANGED]\n");
-      } else {
-        KA_LOGS(1, "\n");
-      }
+static bool addScope(KAnalyzer &Analyzer) {
+  std::string Err;
+  for (auto &glob : Include) {
+    if (!Analyzer.addScope(glob, false, &Err)) {
+      errs() << "bad --include=" << glob << ": " << Err << "\n";
+      return false;
     }
-    KA_LOGS(1, "[" << ID << "] Updated in " << changed << " modules.\n");
   }
-
-  KA_LOGS(1, "[" << ID << "] Finalizing " << modules.size() << " modules.\n");
-  again = true;
-  while (again) {
-    again = false;
-    for (i = modules.begin(), e = modules.end(); i != e; ++i) {
-      again |= doFinalization(i->first);
+  for (auto &glob : Exclude) {
+    if (!Analyzer.addScope(glob, true, &Err)) {
+      errs() << "bad --exclude=" << glob << ": " << Err << "\n";
+      return false;
     }
   }
+  return true;
+}
+
+// one line per input, empty lines and # comments skipped
+static bool readInputList(StringRef path, std::vector<std::string> &inputs) {
+  auto Buf = MemoryBuffer::getFile(path);
+  if (!Buf)
+    return false;
 
-  KA_LOGS(1, "[" << ID << "] Done!\n\n");
-  return;
+  SmallVector<StringRef, 256> Lines;
+  (*Buf)->getBuffer().split(Lines, '\n', -1, false);
+  for (StringRef line : Lines) {
+    line = line.trim();
+    if (!line.empty() && !line.startswith("#"))
+      inputs.push_back(line.str());
+  }
+  return true;
 }
 
-void doBasicInitialization(Module *M) {
-  // struct analysis
-  GlobalCtx.structAnalyzer.run(M, &(M->getDataLayout()));
-  if (VerboseLevel >= 2)
-    GlobalCtx.structAnalyzer.printStructInfo();
+// the inputs of every --arch analyzed one after the other, sharing the
+// summaries of the function bodies the builds have in common. the per-arch
+// reports are printed as each architecture is done, the struct report
+// last, one cache column per architecture
+static int runArchs(unsigned analyses) {
+  struct Cell {
+    bool present = false;
+    std::string cache;
+    UsercopyWindow usercopy;
+  };
+  std::vector<std::string> names;
+  std::map<std::string, std::vector<Cell>> rows;
+  std::shared_ptr<SummaryCache> summaries;
+
+  for (unsigned i = 0; i < Archs.size(); ++i) {
+    StringRef name, list;
+    std::tie(name, list) = StringRef(Archs[i]).split('=');
+    std::vector<std::string> inputs;
+    if (name.empty() || !readInputList(list, inputs)) {
+      errs() << "cannot read --arch=" << Archs[i]
+             << ", expected <name>=<input list>\n";
+      return 1;
+    }
+    names.push_back(name.str());
+    KA_LOGS(0, "[" << name << "] Total " << inputs.size() << " file(s)\n");
+
+    KAnalyzer Analyzer;
+    if (!addScope(Analyzer))
+      return 1;
+    if (summaries)
+      Analyzer.setSummaries(summaries);
+    else
+      summaries = Analyzer.getSummaries();
+    Analyzer.loadModules(inputs);
+    Analyzer.run(analyses);
 
-  // collect global object definitions
-  for (GlobalVariable &G : M->globals()) {
-    if (G.hasExternalLinkage())
-      GlobalCtx.Gobjs[G.getName().str()] = &G;
+    for (auto &R : Analyzer.getAllocatedStructs()) {
+      std::vector<Cell> &cells = rows[R.name];
+      cells.resize(Archs.size());
+      if (cells[i].present)
+        continue;
+      cells[i].present = true;
+      cells[i].cache = R.cache;
+      cells[i].usercopy = R.usercopy;
+    }
+
+    if (DumpCaches || Embedded || Unions || Subsystems || Skb || Percpu)
+      errs() << "# " << name << "\n";
+    if (DumpCaches)
+      Analyzer.printCacheInventory();
+    if (Embedded)
+      Analyzer.printCacheResidency();
+    if (Unions)
+      Analyzer.printUnionOverlaps();
+    if (Subsystems)
+      Analyzer.printSubsystems();
+    if (Skb)
+      Analyzer.printSkbAllocs();
+    if (Percpu)
+      Analyzer.printPercpuAllocs();
+  }
+
+  KA_LOGS(0, "ignore allocation? " << IgnoreAllocation << "\n");
+  errs() << "struct";
+  for (auto &name : names) {
+    errs() << "," << name;
+    if (Usercopy)
+      errs() << "," << name << ".useroffset," << name << ".usersize";
   }
+  errs() << "\n";
 
-  // collect global function definitions
-  // for (Function &F : *M) {
-  //   if (F.hasExternalLinkage() && !F.empty()) {
-  //     // external linkage always ends up with the function name
-  //     StringRef FNameRef = F.getName();
-  //     std::string FName = "";
-  //     if (FNameRef.startswith("__sys_"))
-  //       FName = "sys_" + FNameRef.str().substr(6);
-  //     else
-  //       FName = FNameRef.str();
-  //     // fprintf(stderr, "FName: %s\n", FName.c_str());
-  //     // assert(GlobalCtx.Funcs.count(FName) == 0); // force only one
-  //     defintion GlobalCtx.Funcs[FName] = &F;
-  //   }
-  // }
-
-  return;
+  for (auto &row : rows) {
+    errs() << row.first;
+    for (const Cell &cell : row.second) {
+      errs() << "," << cell.cache;
+      if (!Usercopy)
+        continue;
+      errs() << ",";
+      if (cell.present)
+        printCacheField(errs(), cell.usercopy.offset);
+      errs() << ",";
+      if (cell.present)
+        printCacheField(errs(), cell.usercopy.size);
+    }
+    errs() << "\n";
+  }
+  return 0;
 }
 
 int main(int argc, char **argv) {
@@ -154,37 +266,59 @@ int main(int argc, char **argv) {
   llvm_shutdown_obj Y;
 
   cl::ParseCommandLineOptions(argc, argv, "global analysis\n");
-  SMDiagnostic Err;
+
+  unsigned analyses = KAnalyzer::CredAnalysis |
+                      (Embedded ? KAnalyzer::CacheResidency : 0) |
+                      (Unions ? KAnalyzer::UnionOverlaps : 0) |
+                      (PointsTo ? KAnalyzer::PointsTo : 0);
+  if (!Archs.empty()) {
+    // every build brings its own inputs, a core belongs to one of them
+    if (!InputFilenames.empty() || !Core.empty() || !SaveCore.empty()) {
+      errs() << argv[0]
+             << ": --arch takes no input files, --core or --save-core\n";
+      return 1;
+    }
+    return runArchs(analyses);
+  }
+  if (InputFilenames.empty()) {
+    errs() << argv[0] << ": no input files, give them or --arch\n";
+    return 1;
+  }
 
   // Load modules
   KA_LOGS(0, "Total " << InputFilenames.size() << " file(s)\n");
 
-  for (unsigned i = 0; i < InputFilenames.size(); ++i) {
-    // Use separate LLVMContext to avoid type renaming
-    KA_LOGS(1, "[" << i << "] " << InputFilenames[i] << "\n");
-    LLVMContext *LLVMCtx = new LLVMContext();
-    std::unique_ptr<Module> M = parseIRFile(InputFilenames[i], Err, *LLVMCtx);
-
-    if (M == NULL) {
-      errs() << argv[0] << ": error loading file '" << InputFilenames[i]
-             << "'\n";
-      continue;
-    }
-
-    Module *Module = M.release();
-    StringRef MName = StringRef(strdup(InputFilenames[i].data()));
-    GlobalCtx.Modules.push_back(std::make_pair(Module, MName));
-    GlobalCtx.ModuleMaps[Module] = InputFilenames[i];
-    doBasicInitialization(Module);
+  KAnalyzer Analyzer;
+  if (!addScope(Analyzer))
+    return 1;
+  std::string Err;
+  if (!Core.empty() && !Analyzer.loadCore(Core, &Err)) {
+    errs() << "cannot load --core=" << Core << ": " << Err << "\n";
+    return 1;
   }
+  Analyzer.loadModules(
+      std::vector<std::string>(InputFilenames.begin(), InputFilenames.end()));
 
-  //   CallGraphPass CGPass(&GlobalCtx);
-  //   CGPass.run(GlobalCtx.Modules);
   KA_LOGS(0, "ignore allocation? " << IgnoreAllocation << "\n");
-  CredAnalyzerPass CAPass(&GlobalCtx);
-  CAPass.run(GlobalCtx.Modules);
-  // GlobalCtx.structAnalyzer.printCredStInfo();
-  // GlobalCtx.structAnalyzer.printCredSt();
-  GlobalCtx.structAnalyzer.printAllStructsAndAllocCaches();
+  Analyzer.run(analyses);
+  // Analyzer.getContext().structAnalyzer.printCredStInfo();
+  // Analyzer.getContext().structAnalyzer.printCredSt();
+  Analyzer.printAllStructsAndAllocCaches(Usercopy);
+  if (DumpCaches)
+    Analyzer.printCacheInventory();
+  if (Embedded)
+    Analyzer.printCacheResidency();
+  if (Unions)
+    Analyzer.printUnionOverlaps();
+  if (Subsystems)
+    Analyzer.printSubsystems();
+  if (Skb)
+    Analyzer.printSkbAllocs();
+  if (Percpu)
+    Analyzer.printPercpuAllocs();
+  if (!SaveCore.empty() && !Analyzer.saveCore(SaveCore, &Err)) {
+    errs() << "cannot save --save-core=" << SaveCore << ": " << Err << "\n";
+    return 1;
+  }
   return 0;
 }
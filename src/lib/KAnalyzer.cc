@@ -0,0 +1,1088 @@
+/*
+ * In-process analyzer interface
+ *
+ * For licensing details see LICENSE
+ */
+
+#include <llvm/BinaryFormat/Magic.h>
+#include <llvm/IRReader/IRReader.h>
+#include <llvm/Object/Archive.h>
+#include <llvm/Object/IRObjectFile.h>
+#include <llvm/Support/FileSystem.h>
+#include <llvm/Support/Format.h>
+#include <llvm/Support/MemoryBuffer.h>
+#include <llvm/Support/Path.h>
+#include <llvm/Support/SourceMgr.h>
+
+#include <condition_variable>
+#include <map>
+#include <mutex>
+#include <thread>
+
+#include "CacheDiscovery.h"
+#include "CanonicalTypes.h"
+#include "CallGraph.h"
+#include "CredAnalyzer.h"
+#include "FuncAACache.h"
+#include "FuncHash.h"
+#include "KAnalyzer.h"
+
+using namespace llvm;
+
+cl::opt<unsigned>
+    VerboseLevel("debug-verbose",
+                 cl::desc("Print information about actions taken"),
+                 cl::init(0));
+
+cl::opt<bool>
+    IgnoreAllocation("ignore-allocation",
+                     cl::desc("Ignore the allocation of cred objects"),
+                     cl::NotHidden, cl::init(false));
+
+cl::opt<unsigned>
+    NumThreads("worker-threads",
+               cl::desc("Worker threads for parsing and intra-module "
+                        "analysis (0 = one per core)"),
+               cl::init(1));
+
+cl::opt<unsigned>
+    SharedContexts("shared-contexts",
+                   cl::desc("Parse the modules into this many shared "
+                            "LLVMContexts instead of one each (0 = one per "
+                            "module)"),
+                   cl::init(0));
+
+cl::opt<bool>
+    StripBodies("strip-bodies",
+                cl::desc("Drop function bodies while loading, once their "
+                         "allocation sites are summarized. The call graph "
+                         "then only sees declarations"),
+                cl::init(false));
+
+cl::opt<bool>
+    LocalAA("local-aa",
+            cl::desc("Follow the cache pointers of allocation sites through "
+                     "the memory of their function, with BasicAA and TBAA"),
+            cl::init(false));
+
+cl::opt<unsigned>
+    AACacheInsts("aa-cache-insts",
+                 cl::desc("Instructions of the functions --local-aa keeps "
+                          "the analyses of at once"),
+                 cl::init(FuncAACache::DefaultCapacity));
+
+cl::opt<std::string>
+    SummaryCacheDir("summary-cache",
+                    cl::desc("Directory keeping per-function summaries "
+                             "between runs"),
+                    cl::init(""));
+
+void IterativeModulePass::run(ModuleList &modules) {
+
+  ModuleList::iterator i, e;
+
+  KA_LOGS(1, "[" << ID << "] Initializing " << modules.size() << " modules.\n");
+  bool again = true;
+  while (again) {
+    again = false;
+    for (i = modules.begin(), e = modules.end(); i != e; ++i) {
+      KA_LOGS(1, "[" << i->second << "]\n");
+      again |= doInitialization(i->first);
+    }
+  }
+
+  KA_LOGS(1, "[" << ID << "] Processing " << modules.size() << " modules.\n");
+  unsigned iter = 0, changed = 1;
+  while (changed) {
+    ++iter;
+    changed = 0;
+    for (i = modules.begin(), e = modules.end(); i != e; ++i) {
+      KA_LOGS(1, "[" << ID << " / " << iter << "] ");
+      // FIXME: Seems the module name is incorrect, and perhaps it's a bug.
+      KA_LOGS(1, "[" << i->second << "]\n");
+
+      bool ret = doModulePass(i->first);
+      if (ret) {
+        ++changed;
+        KA_LOGS(1, "\t [CHANGED]\n");
+      } else {
+        KA_LOGS(1, "\n");
+      }
+    }
+    KA_LOGS(1, "[" << ID << "] Updated in " << changed << " modules.\n");
+  }
+
+  KA_LOGS(1, "[" << ID << "] Finalizing " << modules.size() << " modules.\n");
+  again = true;
+  while (again) {
+    again = false;
+    for (i = modules.begin(), e = modules.end(); i != e; ++i) {
+      again |= doFinalization(i->first);
+    }
+  }
+
+  KA_LOGS(1, "[" << ID << "] Done!\n\n");
+  return;
+}
+
+KAnalyzer::KAnalyzer() : Done(0) {
+  unsigned threads = NumThreads;
+  if (threads == 0)
+    threads = std::max(1u, std::thread::hardware_concurrency());
+  if (threads > 1)
+    Ctx.Pool.reset(new WorkStealingPool(threads));
+  Ctx.structAnalyzer.setCacheInventory(&Ctx.Caches);
+  Ctx.StripBodies = StripBodies;
+  Ctx.AA.setCapacity(LocalAA ? AACacheInsts : 0);
+  Ctx.Caches.setAliasCache(&Ctx.AA);
+  if (SharedContexts) {
+    SharedLocks.reset(new std::mutex[SharedContexts]);
+    for (unsigned i = 0; i < SharedContexts; ++i) {
+      LLVMCtxs.emplace_back(new LLVMContext());
+      SharedCtxs.push_back(LLVMCtxs.back().get());
+    }
+  }
+  if (!SummaryCacheDir.empty())
+    Ctx.Summaries.reset(new SummaryCache(SummaryCacheDir));
+}
+
+KAnalyzer::~KAnalyzer() {
+  StreamCA.reset();
+  StreamCD.reset();
+  FuncAACache &AA = Ctx.AA;
+  if (AA.enabled())
+    KA_LOGS(1, "alias analysis: " << AA.built() << " functions analyzed, "
+                                  << AA.hits() << " reused, " << AA.evicted()
+                                  << " evicted\n");
+  AA.clear();
+  // modules reference their contexts, release them first
+  OwnedModules.clear();
+  LLVMCtxs.clear();
+}
+
+std::shared_ptr<SummaryCache> KAnalyzer::getSummaries() {
+  if (!Ctx.Summaries)
+    Ctx.Summaries.reset(new SummaryCache(""));
+  return Ctx.Summaries;
+}
+
+void KAnalyzer::setSummaries(std::shared_ptr<SummaryCache> Summaries) {
+  Ctx.Summaries = std::move(Summaries);
+}
+
+bool KAnalyzer::addScope(const std::string &glob, bool exclude,
+                         std::string *Err) {
+  return Scope.add(glob, exclude, Err);
+}
+
+// bump whenever the summary records change
+static const char CoreMagic[] = "kacore 1";
+
+static bool readCoreField(StringRef field, uint64_t &value) {
+  if (field == "?") {
+    value = CacheInfo::Unknown;
+    return true;
+  }
+  return !field.getAsInteger(10, value);
+}
+
+// text format, one record per line, tab-separated since names may be empty:
+//   kacore <version>
+//   struct <name> <size> <cache> <useroffset> <usersize>
+//   cache <name> <size> <align> <flags> <ctor> <useroffset> <usersize>
+//         <dest>...
+//   alloc <wrapper> <api> [cache]
+// unknown values are written as ?. cache marks a wrapper passing its first
+// argument on as the cache
+bool KAnalyzer::saveCore(const std::string &path, std::string *Err) const {
+  std::error_code EC;
+  raw_fd_ostream OS(path, EC, sys::fs::OF_Text);
+  if (EC) {
+    if (Err)
+      *Err = EC.message();
+    return false;
+  }
+
+  OS << CoreMagic << "\n";
+  for (auto &R : getAllocatedStructs()) {
+    OS << "struct\t" << R.name << '\t';
+    printCacheField(OS, R.allocSize);
+    OS << '\t' << R.cache << '\t';
+    printCacheField(OS, R.usercopy.offset);
+    OS << '\t';
+    printCacheField(OS, R.usercopy.size);
+    OS << "\n";
+  }
+
+  for (auto &cache : Ctx.Caches.caches()) {
+    OS << "cache\t" << cache.name << '\t';
+    printCacheField(OS, cache.size);
+    OS << '\t';
+    printCacheField(OS, cache.align);
+    OS << '\t';
+    printCacheField(OS, cache.flags);
+    OS << '\t' << cache.ctor << '\t';
+    printCacheField(OS, cache.useroffset);
+    OS << '\t';
+    printCacheField(OS, cache.usersize);
+    for (StrId dest : cache.dests)
+      OS << '\t' << internedStr(dest);
+    OS << "\n";
+  }
+
+  // a module can only call the wrappers it may link against. wrappers of
+  // wrappers are saved with the API they end up in
+  std::map<std::string, std::pair<std::string, bool>> wrappers;
+  for (auto &item : Ctx.Caches.wrappers()) {
+    // a static wrapper goes by its scope name, which has a '.'
+    StringRef name = internedStr(item.first);
+    if (name.contains('.'))
+      continue;
+    wrappers[name.str()] = std::make_pair(internedStr(item.second.api).str(),
+                                          item.second.cacheArg);
+  }
+  for (auto &item : Ctx.RetAllocs) {
+    if (item.first->hasLocalLinkage())
+      continue;
+    wrappers.insert(std::make_pair(
+        item.first->getName().str(),
+        std::make_pair(
+            Ctx.Caches.resolveAllocAPI(internedStr(item.second)).str(),
+            false)));
+  }
+  for (auto &item : wrappers) {
+    OS << "alloc\t" << item.first << '\t' << item.second.first;
+    if (item.second.second)
+      OS << "\tcache";
+    OS << "\n";
+  }
+
+  if (OS.has_error()) {
+    OS.clear_error();
+    if (Err)
+      *Err = "write error";
+    return false;
+  }
+  return true;
+}
+
+bool KAnalyzer::loadCore(const std::string &path, std::string *Err) {
+  auto Buf = MemoryBuffer::getFile(path);
+  if (!Buf) {
+    if (Err)
+      *Err = Buf.getError().message();
+    return false;
+  }
+
+  SmallVector<StringRef, 1024> Lines;
+  (*Buf)->getBuffer().split(Lines, '\n', -1, false);
+  if (Lines.empty() || Lines[0] != CoreMagic) {
+    if (Err)
+      *Err = "not a core summary";
+    return false;
+  }
+
+  std::vector<StructRecord> structs;
+  std::vector<CacheInfo> caches;
+  std::vector<std::pair<StrId, CacheInventory::AllocWrapper>> wrappers;
+  for (unsigned i = 1; i < Lines.size(); ++i) {
+    SmallVector<StringRef, 8> Fields;
+    Lines[i].split(Fields, '\t');
+    bool ok = false;
+
+    if (Fields[0] == "struct" && Fields.size() == 6) {
+      StructRecord R;
+      R.name = Fields[1].str();
+      R.cache = Fields[3].str();
+      R.info = nullptr;
+      ok = readCoreField(Fields[2], R.allocSize) &&
+           readCoreField(Fields[4], R.usercopy.offset) &&
+           readCoreField(Fields[5], R.usercopy.size);
+      structs.push_back(R);
+    } else if (Fields[0] == "cache" && Fields.size() >= 8) {
+      CacheInfo info;
+      info.name = Fields[1].str();
+      info.ctor = Fields[5].str();
+      ok = readCoreField(Fields[2], info.size) &&
+           readCoreField(Fields[3], info.align) &&
+           readCoreField(Fields[4], info.flags) &&
+           readCoreField(Fields[6], info.useroffset) &&
+           readCoreField(Fields[7], info.usersize);
+      for (unsigned f = 8; f < Fields.size(); ++f)
+        info.dests.push_back(internStr(Fields[f]));
+      caches.push_back(info);
+    } else if (Fields[0] == "alloc" &&
+               (Fields.size() == 3 ||
+                (Fields.size() == 4 && Fields[3] == "cache"))) {
+      CacheInventory::AllocWrapper W{internStr(Fields[2]), Fields.size() == 4};
+      wrappers.push_back(std::make_pair(internStr(Fields[1]), W));
+      ok = true;
+    }
+
+    if (!ok) {
+      if (Err)
+        *Err = "malformed line " + std::to_string(i + 1);
+      return false;
+    }
+  }
+
+  // the caches of the core come first, the first cache stored to a location
+  // wins
+  for (auto &info : caches)
+    Ctx.Caches.add(info);
+  for (auto &item : wrappers)
+    Ctx.Caches.addWrapper(item.first, item.second.api, item.second.cacheArg);
+  CoreStructs.swap(structs);
+  KA_LOGS(0, "core summary: " << CoreStructs.size() << " structs, "
+                              << caches.size() << " caches, "
+                              << wrappers.size() << " allocation wrappers\n");
+  return true;
+}
+
+void KAnalyzer::doBasicInitialization(Module *M) {
+  // struct analysis
+  Ctx.structAnalyzer.run(M, &(M->getDataLayout()));
+  if (VerboseLevel >= 2)
+    Ctx.structAnalyzer.printStructInfo();
+
+  // collect global object definitions
+  for (GlobalVariable &G : M->globals()) {
+    if (G.hasExternalLinkage())
+      Ctx.Gobjs[internStr(G.getName())] = &G;
+  }
+
+  // hash the bodies that header inlines may have copied into other modules,
+  // the first copy loaded stands for all of them. summaries need every body
+  std::vector<Function *> Candidates;
+  for (Function &F : *M) {
+    if (isDedupCandidate(&F) || (Ctx.Summaries && !F.isDeclaration()))
+      Candidates.push_back(&F);
+  }
+
+  std::vector<uint64_t> Hashes(Candidates.size());
+  Ctx.parallelFor(Candidates.size(), [&](size_t i, unsigned worker) {
+    Hashes[i] = hashFunctionBody(Candidates[i]);
+  });
+
+  for (size_t i = 0; i < Candidates.size(); ++i) {
+    Function *F = Candidates[i];
+    Ctx.FuncHashes[F] = Hashes[i];
+    if (isDedupCandidate(F) &&
+        Ctx.UnifiedFuncMap.insert(std::make_pair(Hashes[i], F)).second)
+      Ctx.UnifiedFuncSet.insert(F);
+  }
+}
+
+// parse an input read by MemoryBuffer::getFileOrSTDIN, the same way
+// parseIRFile would. Err receives the diagnostic on failure
+static std::unique_ptr<Module>
+parseInput(const std::string &path,
+           const ErrorOr<std::unique_ptr<MemoryBuffer>> &Buf,
+           LLVMContext &LLVMCtx, std::string *Err) {
+  SMDiagnostic Diag;
+  std::unique_ptr<Module> M;
+  if (std::error_code EC = Buf.getError())
+    Diag = SMDiagnostic(path, SourceMgr::DK_Error,
+                        "Could not open input file: " + EC.message());
+  else
+    M = parseIR((*Buf)->getMemBufferRef(), Diag, LLVMCtx);
+
+  if (M == nullptr && Err) {
+    raw_string_ostream OS(*Err);
+    Diag.print(nullptr, OS);
+  }
+  return M;
+}
+
+bool KAnalyzer::loadModule(const std::string &path, std::string *Err) {
+  file_magic Magic;
+  if (!SharedCtxs.empty() ||
+      (!identify_magic(path, Magic) && Magic == file_magic::archive))
+    return loadModules(std::vector<std::string>(1, path)) > 0;
+
+  // Use separate LLVMContext to avoid type renaming
+  std::unique_ptr<LLVMContext> LLVMCtx(new LLVMContext());
+  std::unique_ptr<Module> M = parseInput(
+      path, MemoryBuffer::getFileOrSTDIN(path), *LLVMCtx, Err);
+  if (M == nullptr)
+    return false;
+
+  addModule(path, std::move(LLVMCtx), std::move(M));
+  return true;
+}
+
+void KAnalyzer::addModule(const std::string &path,
+                          std::unique_ptr<LLVMContext> LLVMCtx,
+                          std::unique_ptr<Module> M) {
+  ModuleNames.push_back(path);
+  StringRef MName = ModuleNames.back();
+  if (!Scope.empty() && !Scope.inScope({MName, M->getSourceFileName()}))
+    Ctx.OutOfScope.insert(M.get());
+  Ctx.Modules.push_back(std::make_pair(M.get(), MName));
+  Ctx.ModuleMaps[M.get()] = MName;
+  doBasicInitialization(M.get());
+  if (Ctx.StripBodies)
+    summarizeModule(M.get());
+
+  OwnedModules.push_back(std::move(M));
+  if (LLVMCtx)
+    LLVMCtxs.push_back(std::move(LLVMCtx));
+
+  // new module, previous results are stale
+  Done = 0;
+}
+
+// cache discovery and the site scan only look at M itself, run them while
+// the next modules are still loading and drop the bodies they are done with
+void KAnalyzer::summarizeModule(Module *M) {
+  if (!StreamCA) {
+    StreamCD.reset(new CacheDiscoveryPass(&Ctx));
+    StreamCA.reset(new CredAnalyzerPass(&Ctx));
+  }
+  StreamCD->doInitialization(M);
+  StreamCA->doInitialization(M);
+  StreamCA->doModulePass(M);
+}
+
+namespace {
+// one input on its way through the load pipeline
+struct LoadItem {
+  LoadItem(size_t Index_, const std::string &Path_,
+           ErrorOr<std::unique_ptr<MemoryBuffer>> Buf_)
+      : Index(Index_), Path(Path_), Buf(std::move(Buf_)) {}
+
+  size_t Index;
+  // the file, or the archive member as a path next to its archive
+  std::string Path;
+  ErrorOr<std::unique_ptr<MemoryBuffer>> Buf;
+  std::unique_ptr<LLVMContext> LLVMCtx;
+  std::unique_ptr<Module> M;
+  std::string Err;
+  // with shared contexts, the one M lives in and its renamed structs
+  unsigned Shared = 0;
+  CanonicalTypes::Renames Types;
+};
+
+typedef std::function<void(const std::string &,
+                           ErrorOr<std::unique_ptr<MemoryBuffer>>)>
+    InputFn;
+} // namespace
+
+static bool isArchive(const ErrorOr<std::unique_ptr<MemoryBuffer>> &Buf) {
+  return Buf && identify_magic((*Buf)->getBuffer()) == file_magic::archive;
+}
+
+// hand every member of the archive in Buf to emit, in archive order. the
+// members of thin archives (the kernel's built-in.a) are read from disk,
+// nested archives are expanded in place, members without bitcode (plain
+// objects, no .llvmbc section) are skipped and counted
+static void readArchive(const std::string &path, const MemoryBuffer &Buf,
+                        const InputFn &emit, unsigned &skipped) {
+  Error Err = Error::success();
+  object::Archive A(Buf.getMemBufferRef(), Err);
+  if (!Err) {
+    for (const object::Archive::Child &C : A.children(Err)) {
+      Expected<std::string> Name = C.getFullName();
+      if (!Name) {
+        consumeError(Name.takeError());
+        ++skipped;
+        continue;
+      }
+
+      // members of regular archives are named as if they sat next to it,
+      // so module ids look the same as for the unpacked objects
+      std::string member = *Name;
+      ErrorOr<std::unique_ptr<MemoryBuffer>> MBuf =
+          std::unique_ptr<MemoryBuffer>();
+      if (A.isThin()) {
+        MBuf = MemoryBuffer::getFile(member);
+      } else {
+        SmallString<128> Full(sys::path::parent_path(path));
+        sys::path::append(Full, member);
+        member = Full.str().str();
+        Expected<MemoryBufferRef> Ref = C.getMemoryBufferRef();
+        if (!Ref) {
+          MBuf = errorToErrorCode(Ref.takeError());
+        } else {
+          MBuf = MemoryBuffer::getMemBufferCopy(Ref->getBuffer(), member);
+        }
+      }
+
+      if (!MBuf) {
+        emit(member, std::move(MBuf));
+        continue;
+      }
+      if (isArchive(MBuf)) {
+        readArchive(member, **MBuf, emit, skipped);
+        continue;
+      }
+
+      Expected<MemoryBufferRef> BC =
+          object::IRObjectFile::findBitcodeInMemBuffer(
+              (*MBuf)->getMemBufferRef());
+      if (!BC) {
+        consumeError(BC.takeError());
+        ++skipped;
+        continue;
+      }
+      if (BC->getBufferStart() == (*MBuf)->getBufferStart())
+        emit(member, std::move(MBuf));
+      else
+        emit(member, MemoryBuffer::getMemBufferCopy(BC->getBuffer(), member));
+    }
+  }
+
+  if (Err)
+    emit(path, errorToErrorCode(std::move(Err)));
+}
+
+unsigned KAnalyzer::loadModules(const std::vector<std::string> &paths) {
+  // read -> parse -> per-module analysis. every module gets its own
+  // LLVMContext, or one of the shared ones, locked while it is parsed or
+  // analyzed; the analysis stage stays on this thread, since it fills
+  // the global tables, and takes modules in input order so the results
+  // don't depend on which parser finishes first. archives are expanded by
+  // the reader, their members stay together in archive order
+  unsigned parsers = std::max<size_t>(
+      1, std::min<size_t>(Ctx.numWorkers(), paths.size()));
+  // inputs in flight per stage, bounds the file data held ahead of the
+  // parsers and the parsed modules waiting for the analysis
+  size_t depth = 2 * parsers;
+  BoundedQueue<std::unique_ptr<LoadItem>> Read(depth), Parsed(depth);
+
+  // archive messages are kept until the reader is done, logs aren't
+  // thread safe
+  std::vector<std::string> ArchiveLog;
+  std::thread Reader([&] {
+    size_t index = 0;
+    InputFn emit = [&](const std::string &path,
+                       ErrorOr<std::unique_ptr<MemoryBuffer>> Buf) {
+      Read.push(std::unique_ptr<LoadItem>(
+          new LoadItem(index++, path, std::move(Buf))));
+    };
+
+    for (const std::string &path : paths) {
+      ErrorOr<std::unique_ptr<MemoryBuffer>> Buf =
+          MemoryBuffer::getFileOrSTDIN(path);
+      if (!isArchive(Buf)) {
+        emit(path, std::move(Buf));
+        continue;
+      }
+
+      size_t first = index;
+      unsigned skipped = 0;
+      readArchive(path, **Buf, emit, skipped);
+      ArchiveLog.push_back(path + ": " + std::to_string(index - first) +
+                           " member(s), " + std::to_string(skipped) +
+                           " without bitcode");
+    }
+    Read.close();
+  });
+
+  // the next input the analysis takes. a parser holds back an input more
+  // than depth ahead of it, which bounds the modules parsed out of order
+  size_t next = 0;
+  std::mutex WindowLock;
+  std::condition_variable WindowMoved;
+
+  std::atomic<unsigned> Running(parsers);
+  std::vector<std::thread> Parsers;
+  for (unsigned p = 0; p < parsers; ++p) {
+    Parsers.emplace_back([&] {
+      std::unique_ptr<LoadItem> Item;
+      while (Read.pop(Item)) {
+        {
+          std::unique_lock<std::mutex> Guard(WindowLock);
+          WindowMoved.wait(Guard,
+                           [&] { return Item->Index < next + depth; });
+        }
+        if (SharedCtxs.empty()) {
+          Item->LLVMCtx.reset(new LLVMContext());
+          Item->M =
+              parseInput(Item->Path, Item->Buf, *Item->LLVMCtx, &Item->Err);
+        } else {
+          Item->Shared = Item->Index % SharedCtxs.size();
+          std::lock_guard<std::mutex> Lock(SharedLocks[Item->Shared]);
+          Item->M = parseInput(Item->Path, Item->Buf,
+                               *SharedCtxs[Item->Shared], &Item->Err);
+          if (Item->M)
+            CanonicalTypes::detach(Item->M.get(), Item->Types);
+        }
+        Item->Buf = std::unique_ptr<MemoryBuffer>();
+        Parsed.push(std::move(Item));
+      }
+      if (--Running == 0)
+        Parsed.close();
+    });
+  }
+
+  // parsed modules are always taken off the queue, so a parser never
+  // blocks behind the module the analysis is waiting for
+  unsigned loaded = 0;
+  std::map<size_t, std::unique_ptr<LoadItem>> Pending;
+  std::unique_ptr<LoadItem> Item;
+  while (Parsed.pop(Item)) {
+    Pending[Item->Index] = std::move(Item);
+    for (auto itr = Pending.find(next); itr != Pending.end();
+         itr = Pending.find(next)) {
+      LoadItem &Ready = *itr->second;
+      KA_LOGS(1, "[" << next << "] " << Ready.Path << "\n");
+      if (Ready.M) {
+        std::unique_lock<std::mutex> Lock;
+        if (!SharedCtxs.empty()) {
+          Lock = std::unique_lock<std::mutex>(SharedLocks[Ready.Shared]);
+          Ctx.Types.add(Ready.Types);
+        }
+        addModule(Ready.Path, std::move(Ready.LLVMCtx), std::move(Ready.M));
+        ++loaded;
+      } else {
+        errs() << "error loading file '" << Ready.Path << "': " << Ready.Err;
+      }
+      Pending.erase(itr);
+      {
+        std::lock_guard<std::mutex> Guard(WindowLock);
+        ++next;
+      }
+      WindowMoved.notify_all();
+    }
+  }
+
+  Reader.join();
+  for (auto &T : Parsers)
+    T.join();
+  for (auto &line : ArchiveLog)
+    KA_LOGS(1, "[archive] " << line << "\n");
+  return loaded;
+}
+
+void KAnalyzer::run(unsigned analyses) {
+  if (analyses & (CacheResidency | PointsTo))
+    analyses |= CredAnalysis;
+
+  bool scanned = false;
+  // the modules were summarized while loading, only finalization is left
+  if (StreamCA) {
+    for (auto &M : Ctx.Modules)
+      StreamCA->doFinalization(M.first);
+    StreamCA.reset();
+    StreamCD.reset();
+    Done |= CacheDiscovery | CredAnalysis;
+    scanned = true;
+  }
+
+  if ((analyses & (CacheDiscovery | CredAnalysis)) &&
+      !hasRun(CacheDiscovery)) {
+    CacheDiscoveryPass CDPass(&Ctx);
+    CDPass.run(Ctx.Modules);
+    Done |= CacheDiscovery;
+  }
+
+  if ((analyses & CallGraph) && !hasRun(CallGraph)) {
+    CallGraphPass CGPass(&Ctx);
+    CGPass.run(Ctx.Modules);
+    Done |= CallGraph;
+  }
+
+  if ((analyses & CredAnalysis) && !hasRun(CredAnalysis)) {
+    CredAnalyzerPass CAPass(&Ctx);
+    CAPass.run(Ctx.Modules);
+    Done |= CredAnalysis;
+    scanned = true;
+  }
+  if (scanned && !Scope.empty())
+    KA_LOGS(0, "scope: " << Ctx.OutOfScope.size() << " of "
+                         << Ctx.Modules.size() << " modules out of scope, "
+                         << Ctx.SkippedFuncs << " bodies not scanned\n");
+
+  // before the residency, embedded structs take the resolved caches over
+  if ((analyses & PointsTo) && !hasRun(PointsTo)) {
+    if (StripBodies)
+      KA_LOGS(0, "points-to: skipped, the bodies were stripped\n");
+    else
+      solvePointsTo();
+    Done |= PointsTo;
+  }
+
+  if ((analyses & CacheResidency) && !hasRun(CacheResidency)) {
+    Ctx.structAnalyzer.propagateCacheResidency(&Ctx.Caches);
+    Done |= CacheResidency;
+  }
+
+  if ((analyses & UnionOverlaps) && !hasRun(UnionOverlaps)) {
+    Ctx.structAnalyzer.computeUnionOverlaps(Ctx.Pool.get());
+    Done |= UnionOverlaps;
+  }
+
+  if (Ctx.Summaries) {
+    Ctx.Summaries->flush();
+    KA_LOGS(1, "summaries: " << Ctx.Summaries->hits() << " reused, "
+                             << Ctx.Summaries->misses() << " computed\n");
+  }
+}
+
+void KAnalyzer::solvePointsTo() {
+  const CacheInventory &Caches = Ctx.Caches;
+  Ctx.PointsTo.reset(new Andersen([&Caches](CallBase *CB) {
+    Function *F = CB->getCalledFunction();
+    if (!F)
+      return false;
+    auto *CI = dyn_cast<CallInst>(CB);
+    return (CI && Caches.lookupCreationSite(CI)) ||
+           AllocAPIs.count(Caches.resolveAllocAPI(F));
+  }));
+  Andersen &PTA = *Ctx.PointsTo;
+  for (auto &M : Ctx.Modules)
+    PTA.addModule(M.first);
+  PTA.solve();
+
+  // a cache pointer passed around in arguments and struct fields, that
+  // may only come from one creation site
+  unsigned resolved = 0;
+  std::vector<Andersen::Pointee> pointees;
+  for (auto const &mapping : Ctx.structAnalyzer.getStructInfoMap()) {
+    for (CallInst *CI : mapping.second.allocSite) {
+      Function *F = CI->getCalledFunction();
+      bool cacheArg = false;
+      StringRef api = Ctx.Caches.resolveAllocAPI(F, &cacheArg);
+      if (!cacheArg || !specific_alloc.count(api) ||
+          Ctx.Caches.lookupAllocSite(CI))
+        continue;
+
+      pointees.clear();
+      PTA.getPointees(CI->getArgOperand(0), pointees);
+      const CallInst *create = nullptr;
+      for (auto &P : pointees) {
+        auto *site = dyn_cast_or_null<CallInst>(P.first);
+        if (!site || P.second != 0 || (create && site != create)) {
+          create = nullptr;
+          break;
+        }
+        create = site;
+      }
+      if (create &&
+          Ctx.Caches.addAllocSiteCache(CI, const_cast<CallInst *>(create)))
+        ++resolved;
+    }
+  }
+
+  // the callees by type that the function pointer may hold
+  unsigned narrowed = 0;
+  if (hasRun(CallGraph)) {
+    std::vector<Function *> targets;
+    for (CallInst *CI : Ctx.IndirectCallInsts) {
+      targets.clear();
+      PTA.getCallees(CI, targets);
+      if (targets.empty())
+        continue;
+      StringSet<> names;
+      for (Function *F : targets)
+        names.insert(F->getName());
+
+      FuncSet &FS = Ctx.Callees[CI];
+      FuncSet keep;
+      for (Function *F : FS) {
+        if (names.count(F->getName()))
+          keep.insert(F);
+      }
+      if (keep.empty() || keep.size() == FS.size())
+        continue;
+      for (Function *F : FS) {
+        if (!keep.count(F))
+          Ctx.Callers[F].erase(CI);
+      }
+      FS = keep;
+      ++narrowed;
+    }
+  }
+
+  KA_LOGS(0, "points-to: " << PTA.numNodes() << " nodes, "
+                           << PTA.numObjects() << " objects, "
+                           << PTA.numWaves() << " waves, "
+                           << PTA.numCollapsed() << " collapsed; "
+                           << resolved << " alloc sites resolved, "
+                           << narrowed << " indirect calls narrowed\n");
+}
+
+void KAnalyzer::forEachStruct(
+    std::function<void(const StructInfo &)> fn) const {
+  for (auto const &mapping : Ctx.structAnalyzer.getStructInfoMap())
+    fn(mapping.second);
+}
+
+const StructInfo *KAnalyzer::getStruct(const std::string &name) const {
+  // accept both "foo" and "struct.foo"
+  if (name.find("struct.") == 0 || name.find("union.") == 0)
+    return Ctx.structAnalyzer.getStructInfo(name);
+  return Ctx.structAnalyzer.getStructInfo("struct." + name);
+}
+
+std::vector<KAnalyzer::StructRecord> KAnalyzer::getAllocatedStructs() const {
+  std::vector<StructRecord> records;
+
+  Ctx.structAnalyzer.forEachAllocatedStruct(
+      [this, &records](const std::string &name, const StructInfo &info) {
+        StructRecord R;
+        R.name = name;
+        R.allocSize = info.getAllocSize();
+        R.cache = info.getAllocCache(&Ctx.Caches, &R.usercopy);
+        R.info = &info;
+        records.push_back(R);
+      });
+  if (CoreStructs.empty())
+    return records;
+
+  // the core's row stands for a struct it has a cache for, the module adds
+  // the structs the core doesn't allocate or couldn't place
+  std::set<std::string> placed, loaded;
+  for (auto &R : CoreStructs) {
+    if (!R.cache.empty())
+      placed.insert(R.name);
+  }
+  std::vector<StructRecord> merged;
+  for (auto &R : records) {
+    if (placed.count(R.name))
+      continue;
+    loaded.insert(R.name);
+    merged.push_back(R);
+  }
+  for (auto &R : CoreStructs) {
+    if (!R.cache.empty() || !loaded.count(R.name))
+      merged.push_back(R);
+  }
+
+  std::stable_sort(merged.begin(), merged.end(),
+                   [](const StructRecord &a, const StructRecord &b) {
+                     return a.name < b.name;
+                   });
+  return merged;
+}
+
+std::vector<KAnalyzer::CacheRecord> KAnalyzer::getCaches() const {
+  std::map<std::string, std::vector<std::string>> caches;
+
+  for (auto &R : getAllocatedStructs()) {
+    if (R.cache.empty())
+      continue;
+    caches[R.cache].push_back(R.name);
+  }
+
+  std::vector<CacheRecord> records;
+  for (auto &item : caches) {
+    CacheRecord R;
+    R.name = item.first;
+    R.structs = item.second;
+    records.push_back(R);
+  }
+  return records;
+}
+
+const std::set<CallInst *> *
+KAnalyzer::getAllocSites(const std::string &name) const {
+  const StructInfo *info = getStruct(name);
+  if (!info)
+    return nullptr;
+  return &info->allocSite;
+}
+
+void KAnalyzer::printCacheResidency() const {
+  Ctx.structAnalyzer.printCacheResidency();
+}
+
+void KAnalyzer::printUnionOverlaps() const {
+  Ctx.structAnalyzer.printUnionOverlaps();
+}
+
+void KAnalyzer::printAllStructsAndAllocCaches(bool usercopy) const {
+  if (CoreStructs.empty()) {
+    Ctx.structAnalyzer.printAllStructsAndAllocCaches(usercopy);
+    return;
+  }
+
+  for (auto &R : getAllocatedStructs()) {
+    errs() << R.name << "," << R.cache;
+    if (usercopy) {
+      errs() << ",";
+      printCacheField(errs(), R.usercopy.offset);
+      errs() << ",";
+      printCacheField(errs(), R.usercopy.size);
+    }
+    errs() << "\n";
+  }
+}
+
+void KAnalyzer::printCacheInventory() const {
+  for (auto &cache : Ctx.Caches.caches()) {
+    errs() << (cache.name.empty() ? "?" : cache.name) << ",";
+    printCacheField(errs(), cache.size);
+    errs() << ",";
+    printCacheField(errs(), cache.align);
+    errs() << ",";
+    printCacheField(errs(), cache.flags);
+    errs() << "," << cache.ctor << ",";
+    printCacheField(errs(), cache.useroffset);
+    errs() << ",";
+    printCacheField(errs(), cache.usersize);
+    errs() << ",";
+    for (unsigned i = 0; i < cache.dests.size(); ++i)
+      errs() << (i ? ";" : "") << internedStr(cache.dests[i]);
+    errs() << "\n";
+  }
+}
+
+// SMP_CACHE_BYTES, SKB_DATA_ALIGN aligns to it. 64 on x86_64 and arm64
+static const uint64_t SkbDataAlign = 64;
+
+void KAnalyzer::printSkbAllocs() const {
+  const StructInfo *shinfo = getStruct("skb_shared_info");
+  uint64_t shinfoSize = shinfo ? shinfo->getAllocSize() : 0;
+  auto align = [](uint64_t size) {
+    return (size + SkbDataAlign - 1) & ~(SkbDataAlign - 1);
+  };
+
+  std::vector<const SkbAlloc *> rows;
+  for (auto &alloc : Ctx.SkbAllocs)
+    rows.push_back(&alloc);
+  std::stable_sort(rows.begin(), rows.end(),
+                   [](const SkbAlloc *a, const SkbAlloc *b) {
+                     return std::tie(a->func, a->api, a->size) <
+                            std::tie(b->func, b->api, b->size);
+                   });
+
+  for (const SkbAlloc *alloc : rows) {
+    errs() << alloc->func << "," << alloc->api << ",";
+    printCacheField(errs(), alloc->size);
+    errs() << ",";
+    if (alloc->size != CacheInfo::Unknown && shinfoSize)
+      errs() << StructInfo::getKmallocSizeClass(align(alloc->size) +
+                                                align(shinfoSize));
+    else
+      errs() << "?";
+    errs() << "\n";
+  }
+}
+
+// pcpu_alloc rounds sizes up to PCPU_MIN_ALLOC_SIZE
+static const uint64_t PercpuMinAllocSize = 4;
+
+void KAnalyzer::printPercpuAllocs() const {
+  Ctx.structAnalyzer.forEachAllocatedStruct(
+      [this](const std::string &structname, const StructInfo &info) {
+        unsigned sites = 0;
+        info.forEachAllocSite(&Ctx.Caches,
+                              [&sites](const Module *, const std::string &cache,
+                                       bool, unsigned n) {
+                                if (cache == PercpuPlacement)
+                                  sites += n;
+                              });
+        if (!sites)
+          return;
+        uint64_t size = info.getAllocSize();
+        uint64_t chunk = (size + PercpuMinAllocSize - 1) &
+                         ~(PercpuMinAllocSize - 1);
+        errs() << structname << "," << size << "," << chunk << "," << sites
+               << "\n";
+      });
+}
+
+// net/ipv4 for net/ipv4/tcp.c, kernel for kernel/fork.c. Kbuild compiles
+// with paths relative to the tree, so source_filename is preferred. of an
+// absolute path, only its directory can be told
+static std::string getSubsystem(StringRef path, StringRef source) {
+  StringRef rel = !source.empty() && !sys::path::is_absolute(source)
+                      ? source
+                      : path;
+  StringRef dir = sys::path::parent_path(rel);
+  if (dir.empty())
+    return ".";
+  if (sys::path::is_absolute(dir))
+    return dir.str();
+
+  auto first = sys::path::begin(dir), end = sys::path::end(dir);
+  std::string subsystem = first->str();
+  if (++first != end)
+    subsystem += "/" + first->str();
+  return subsystem;
+}
+
+void KAnalyzer::printSubsystems() const {
+  struct Group {
+    unsigned structs = 0, sites = 0, dedicated = 0, generic = 0, percpu = 0;
+    std::map<std::string, unsigned> caches;
+  };
+  typedef std::map<std::string, Group> Groups;
+
+  std::unordered_map<const Module *, std::string> subsystems;
+  for (auto &M : Ctx.Modules)
+    subsystems[M.first] =
+        getSubsystem(M.second, M.first->getSourceFileName());
+
+  std::vector<const StructInfo *> structs;
+  Ctx.structAnalyzer.forEachAllocatedStruct(
+      [&structs](const std::string &, const StructInfo &info) {
+        structs.push_back(&info);
+      });
+
+  // grouped per worker, a struct's sites all go to the same one
+  std::vector<Groups> partial(Ctx.numWorkers());
+  auto count = [&](size_t i, unsigned worker) {
+    Groups &groups = partial[worker];
+    std::set<std::string> seen;
+    structs[i]->forEachAllocSite(
+        &Ctx.Caches, [&](const Module *M, const std::string &cache,
+                         bool generic, unsigned sites) {
+          auto itr = subsystems.find(M);
+          const std::string &name =
+              itr == subsystems.end() ? std::string("?") : itr->second;
+          Group &G = groups[name];
+          if (seen.insert(name).second)
+            ++G.structs;
+          G.sites += sites;
+          if (generic)
+            G.generic += sites;
+          else if (cache == PercpuPlacement)
+            G.percpu += sites;
+          else if (!cache.empty())
+            G.dedicated += sites;
+          if (cache != PercpuPlacement)
+            G.caches[cache.empty() ? "?" : cache] += sites;
+        });
+  };
+  // a site's cache may come from the alias analysis, which isn't thread
+  // safe
+  if (Ctx.AA.enabled()) {
+    for (size_t i = 0; i < structs.size(); ++i)
+      count(i, 0);
+  } else {
+    Ctx.parallelFor(structs.size(), count);
+  }
+
+  Groups groups;
+  for (auto &part : partial) {
+    for (auto &item : part) {
+      Group &G = groups[item.first];
+      G.structs += item.second.structs;
+      G.sites += item.second.sites;
+      G.dedicated += item.second.dedicated;
+      G.generic += item.second.generic;
+      G.percpu += item.second.percpu;
+      for (auto &cache : item.second.caches)
+        G.caches[cache.first] += cache.second;
+    }
+  }
+
+  for (auto &item : groups) {
+    const Group &G = item.second;
+    errs() << item.first << "," << G.structs << "," << G.sites << ","
+           << G.dedicated << "," << G.generic << "," << G.percpu << ",";
+    if (G.dedicated + G.generic)
+      errs() << format("%.1f", 100.0 * G.dedicated /
+                                   (G.dedicated + G.generic));
+    else
+      errs() << "?";
+    errs() << ",";
+    unsigned i = 0;
+    for (auto &cache : G.caches)
+      errs() << (i++ ? ";" : "") << cache.first << ":" << cache.second;
+    errs() << "\n";
+  }
+}
@@ -0,0 +1,162 @@
+#ifndef _KANALYZER_H
+#define _KANALYZER_H
+
+#include <llvm/IR/LLVMContext.h>
+#include <llvm/IR/Module.h>
+
+#include <functional>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "GlobalCtx.h"
+#include "PathFilter.h"
+
+class CacheDiscoveryPass;
+class CredAnalyzerPass;
+
+// In-process interface to the analyzer. Modules are loaded once and the
+// analyses run at most once; every query afterwards is served from the
+// loaded state, so embedding tools can ask many questions per process.
+class KAnalyzer {
+public:
+  enum Analysis {
+    CredAnalysis = 1 << 0,
+    CallGraph = 1 << 1,
+    // CredAnalysis reports need it and run it as well
+    CacheDiscovery = 1 << 2,
+    // caches of embedded structs, implies CredAnalysis
+    CacheResidency = 1 << 3,
+    // unions of every struct and their members
+    UnionOverlaps = 1 << 4,
+    // whole-program points-to sets, resolving the caches of the sites
+    // CacheDiscovery leaves open. implies CredAnalysis, needs the bodies
+    PointsTo = 1 << 5,
+  };
+
+  // one row of the struct/cache report
+  struct StructRecord {
+    std::string name;
+    uint64_t allocSize;
+    std::string cache;
+    // usercopy whitelist of the cache, CacheInfo::Unknown if unresolved
+    UsercopyWindow usercopy;
+    // null for a row of the core summary
+    const StructInfo *info;
+  };
+
+  // structs allocated from one cache
+  struct CacheRecord {
+    std::string name;
+    std::vector<std::string> structs;
+  };
+
+  KAnalyzer();
+  ~KAnalyzer();
+
+  // load one bitcode/IR file, returns false and fills Err on failure. an
+  // archive loads all its members, failures are reported as they happen
+  bool loadModule(const std::string &path, std::string *Err = nullptr);
+  // load all files, returns the number of modules loaded. reading, parsing
+  // and the per-module analyses overlap, modules are still added in order
+  unsigned loadModules(const std::vector<std::string> &paths);
+
+  // summaries of the function bodies, in memory only unless a summary
+  // cache directory was given. the analyzer of the same kernel built for
+  // another architecture takes them over before loading, and skips the
+  // bodies both builds have in common
+  std::shared_ptr<SummaryCache> getSummaries();
+  void setSummaries(std::shared_ptr<SummaryCache> Summaries);
+
+  // limit the site scan and the reports to the modules whose input path or
+  // source_filename matches the globs. call before loading, returns false
+  // and fills Err if glob is malformed
+  bool addScope(const std::string &glob, bool exclude,
+                std::string *Err = nullptr);
+
+  // summary of a core kernel: the struct report, the cache inventory and
+  // the allocation wrappers. saved after the run over the core kernel, and
+  // loaded before the modules of a .ko, which are then analyzed against it
+  // without loading the kernel again
+  bool saveCore(const std::string &path, std::string *Err = nullptr) const;
+  bool loadCore(const std::string &path, std::string *Err = nullptr);
+
+  // run the selected analyses, analyses that already ran are skipped
+  void run(unsigned analyses = CredAnalysis);
+  bool hasRun(Analysis A) const { return (Done & A) != 0; }
+
+  // queries. with a core summary loaded, the struct report has its rows
+  // as well
+  void forEachStruct(std::function<void(const StructInfo &)> fn) const;
+  const StructInfo *getStruct(const std::string &name) const;
+  std::vector<StructRecord> getAllocatedStructs() const;
+  std::vector<CacheRecord> getCaches() const;
+  // sites whose bodies were stripped are only kept as StructInfo::allocFacts
+  const std::set<llvm::CallInst *> *getAllocSites(const std::string &name) const;
+  const CacheInventory &getCacheInventory() const { return Ctx.Caches; }
+
+  void printAllStructsAndAllocCaches(bool usercopy = false) const;
+  // struct,cache,offsets for every cache a struct may live in, embedded in
+  // another struct or not
+  void printCacheResidency() const;
+  // cache,struct,offset,size,union,members for every union in a cache
+  // object, the ';'-separated members are name:type
+  void printUnionOverlaps() const;
+  // name,size,align,flags,ctor,useroffset,usersize,destinations of every
+  // created cache. the ';'-separated destination ids may contain commas, so
+  // they come last
+  void printCacheInventory() const;
+  // subsystem,structs,sites,dedicated,generic,percpu,dedicated%,caches for
+  // the subsystems the allocation sites are in, by the first two directories
+  // of their module's source path. the ';'-separated caches are cache:sites,
+  // kmalloc caches standing for the size classes. dedicated% is of the slab
+  // sites, per-CPU ones aren't in a cache
+  void printSubsystems() const;
+  // struct,size,chunk,sites for every struct allocated per CPU, chunk being
+  // the bytes it takes in each CPU's unit of a per-CPU chunk
+  void printPercpuAllocs() const;
+  // function,api,size,cache for every skb allocation, cache being the
+  // kmalloc cache of the data buffer, the size plus the skb_shared_info at
+  // its end
+  void printSkbAllocs() const;
+
+  GlobalContext &getContext() { return Ctx; }
+  const ModuleList &getModules() const { return Ctx.Modules; }
+
+private:
+  void doBasicInitialization(llvm::Module *M);
+  // take ownership of a parsed module and run the per-module analyses
+  void addModule(const std::string &path,
+                 std::unique_ptr<llvm::LLVMContext> LLVMCtx,
+                 std::unique_ptr<llvm::Module> M);
+  // with StripBodies, summarize M as soon as it is loaded
+  void summarizeModule(llvm::Module *M);
+  // solve the points-to sets and apply them to the alloc sites and, if
+  // the call graph ran, to the callees of indirect calls
+  void solvePointsTo();
+
+  // contexts have to outlive their modules, keep them declared first
+  std::vector<std::unique_ptr<llvm::LLVMContext>> LLVMCtxs;
+  // with --shared-contexts, the contexts modules are parsed into, each
+  // locked while a module is parsed or analyzed in it
+  std::vector<llvm::LLVMContext *> SharedCtxs;
+  std::unique_ptr<std::mutex[]> SharedLocks;
+  std::vector<std::unique_ptr<llvm::Module>> OwnedModules;
+  std::list<std::string> ModuleNames;
+
+  GlobalContext Ctx;
+  unsigned Done;
+
+  PathFilter Scope;
+
+  // struct report of the core summary, sorted by name
+  std::vector<StructRecord> CoreStructs;
+
+  // passes that saw the loaded modules but are not finalized yet
+  std::unique_ptr<CacheDiscoveryPass> StreamCD;
+  std::unique_ptr<CredAnalyzerPass> StreamCA;
+};
+
+#endif
@@ -0,0 +1,38 @@
+/*
+ * Include/exclude globs over module paths
+ *
+ * For licensing details see LICENSE
+ */
+
+#include "PathFilter.h"
+
+using namespace llvm;
+
+bool PathFilter::add(StringRef glob, bool exclude, std::string *Err) {
+  Expected<GlobPattern> Pat = GlobPattern::create(glob);
+  if (!Pat) {
+    std::string Msg = toString(Pat.takeError());
+    if (Err)
+      *Err = Msg;
+    return false;
+  }
+  (exclude ? Excludes : Includes).push_back(std::move(*Pat));
+  return true;
+}
+
+bool PathFilter::matchAny(const std::vector<GlobPattern> &globs,
+                          ArrayRef<StringRef> paths) {
+  for (auto &glob : globs) {
+    for (StringRef path : paths) {
+      if (!path.empty() && glob.match(path))
+        return true;
+    }
+  }
+  return false;
+}
+
+bool PathFilter::inScope(ArrayRef<StringRef> paths) const {
+  if (!Includes.empty() && !matchAny(Includes, paths))
+    return false;
+  return !matchAny(Excludes, paths);
+}
@@ -0,0 +1,30 @@
+#ifndef _PATH_FILTER_H
+#define _PATH_FILTER_H
+
+#include <llvm/ADT/ArrayRef.h>
+#include <llvm/ADT/StringRef.h>
+#include <llvm/Support/GlobPattern.h>
+
+#include <string>
+#include <vector>
+
+// --include/--exclude globs over the paths of a module, its input file and
+// the source_filename it was compiled from. A module is in scope if one of
+// its paths matches an include, or there are none, and none of them matches
+// an exclude. The globs match whole paths, '*' crosses directories.
+class PathFilter {
+public:
+  // returns false and fills Err if glob is malformed
+  bool add(llvm::StringRef glob, bool exclude, std::string *Err = nullptr);
+
+  bool empty() const { return Includes.empty() && Excludes.empty(); }
+  bool inScope(llvm::ArrayRef<llvm::StringRef> paths) const;
+
+private:
+  static bool matchAny(const std::vector<llvm::GlobPattern> &globs,
+                       llvm::ArrayRef<llvm::StringRef> paths);
+
+  std::vector<llvm::GlobPattern> Includes, Excludes;
+};
+
+#endif
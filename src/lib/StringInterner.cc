@@ -0,0 +1,228 @@
+/*
+ * Concurrent string interner
+ *
+ * For licensing details see LICENSE
+ */
+
+#include <llvm/Support/xxhash.h>
+
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+
+#include "StringInterner.h"
+
+using namespace llvm;
+
+static const uint64_t EmptySlot = 0;
+static const uint64_t FrozenSlot = ~0ULL;
+static const uint64_t InitialCap = 1024;
+static const size_t BlockSize = 1 << 20;
+
+static inline uint64_t packSlot(uint32_t Hash, StrId Id) {
+  return ((uint64_t)Hash << 32) | (uint64_t)(Id + 1);
+}
+
+static inline StrId slotId(uint64_t Slot) { return (StrId)Slot - 1; }
+
+static inline uint32_t slotHash(uint64_t Slot) { return Slot >> 32; }
+
+StringInterner::StringInterner() : NextId(0), Arena(nullptr) {
+  for (auto &Sh : Shards)
+    Sh.Cur.store(newTable(InitialCap), std::memory_order_relaxed);
+  for (auto &C : Chunks)
+    C.store(nullptr, std::memory_order_relaxed);
+}
+
+StringInterner::~StringInterner() {
+  for (auto &Sh : Shards) {
+    freeTable(Sh.Cur.load());
+    for (Table *T : Sh.Retired)
+      freeTable(T);
+  }
+  for (auto &C : Chunks)
+    delete[] C.load();
+  Block *B = Arena.load();
+  while (B) {
+    Block *Next = B->Next;
+    delete[] B->Data;
+    delete B;
+    B = Next;
+  }
+}
+
+StringInterner &StringInterner::global() {
+  static StringInterner Interner;
+  return Interner;
+}
+
+StringInterner::Table *StringInterner::newTable(uint64_t Cap) {
+  Table *T = new Table();
+  T->Mask = Cap - 1;
+  T->Count.store(0, std::memory_order_relaxed);
+  T->Slots = new std::atomic<uint64_t>[Cap];
+  for (uint64_t i = 0; i < Cap; ++i)
+    T->Slots[i].store(EmptySlot, std::memory_order_relaxed);
+  return T;
+}
+
+void StringInterner::freeTable(Table *T) {
+  delete[] T->Slots;
+  delete T;
+}
+
+const char *StringInterner::allocBytes(size_t Len) {
+  while (true) {
+    Block *B = Arena.load(std::memory_order_acquire);
+    if (B) {
+      size_t Off = B->Used.fetch_add(Len, std::memory_order_relaxed);
+      if (Off + Len <= B->Cap)
+        return B->Data + Off;
+    }
+
+    // current block is full, race to install a fresh one
+    Block *NB = new Block();
+    NB->Next = B;
+    NB->Cap = std::max(BlockSize, Len);
+    NB->Used.store(0, std::memory_order_relaxed);
+    NB->Data = new char[NB->Cap];
+    if (!Arena.compare_exchange_strong(B, NB, std::memory_order_acq_rel)) {
+      delete[] NB->Data;
+      delete NB;
+    }
+  }
+}
+
+StrId StringInterner::newEntry(StringRef S) {
+  StrId Id = NextId.fetch_add(1, std::memory_order_relaxed);
+  assert(Id < InvalidId - 1 && "string interner is full");
+
+  std::atomic<Entry *> &Chunk = Chunks[Id >> ChunkBits];
+  Entry *C = Chunk.load(std::memory_order_acquire);
+  if (!C) {
+    Entry *NC = new Entry[1u << ChunkBits]();
+    if (Chunk.compare_exchange_strong(C, NC, std::memory_order_acq_rel))
+      C = NC;
+    else
+      delete[] NC;
+  }
+
+  char *Data = const_cast<char *>(allocBytes(S.size()));
+  memcpy(Data, S.data(), S.size());
+  Entry &E = C[Id & ((1u << ChunkBits) - 1)];
+  E.Data = Data;
+  E.Len = S.size();
+  // published by the release CAS on the table slot
+  return Id;
+}
+
+StringRef StringInterner::str(StrId Id) const {
+  if (Id == InvalidId)
+    return StringRef();
+  const Entry *C = Chunks[Id >> ChunkBits].load(std::memory_order_acquire);
+  assert(C && "unknown string id");
+  const Entry &E = C[Id & ((1u << ChunkBits) - 1)];
+  return StringRef(E.Data, E.Len);
+}
+
+bool StringInterner::matches(uint64_t Slot, uint32_t Hash,
+                             StringRef S) const {
+  if (slotHash(Slot) != Hash)
+    return false;
+  return str(slotId(Slot)) == S;
+}
+
+void StringInterner::waitGrow(Shard &Sh) const {
+  // the grower holds the lock until the new table is published
+  std::lock_guard<std::mutex> Guard(Sh.GrowLock);
+}
+
+void StringInterner::grow(Shard &Sh, Table *T) {
+  std::lock_guard<std::mutex> Guard(Sh.GrowLock);
+  if (Sh.Cur.load(std::memory_order_acquire) != T)
+    return;
+
+  Table *NT = newTable((T->Mask + 1) * 2);
+  for (uint64_t i = 0; i <= T->Mask; ++i) {
+    uint64_t V = T->Slots[i].exchange(FrozenSlot, std::memory_order_acq_rel);
+    if (V == EmptySlot || V == FrozenSlot)
+      continue;
+
+    uint64_t Pos = slotHash(V) & NT->Mask;
+    while (NT->Slots[Pos].load(std::memory_order_relaxed) != EmptySlot)
+      Pos = (Pos + 1) & NT->Mask;
+    NT->Slots[Pos].store(V, std::memory_order_relaxed);
+    NT->Count.fetch_add(1, std::memory_order_relaxed);
+  }
+
+  // readers may still be probing the old table, keep it until shutdown
+  Sh.Retired.push_back(T);
+  Sh.Cur.store(NT, std::memory_order_release);
+}
+
+StrId StringInterner::intern(StringRef S) {
+  uint64_t H = xxHash64(S);
+  uint32_t Hash = (uint32_t)H;
+  Shard &Sh = Shards[H >> (64 - ShardBits)];
+  StrId NewId = InvalidId;
+
+  while (true) {
+    Table *T = Sh.Cur.load(std::memory_order_acquire);
+    uint64_t Pos = Hash & T->Mask;
+
+    // leaves only when the table has to be reloaded
+    while (true) {
+      uint64_t V = T->Slots[Pos].load(std::memory_order_acquire);
+
+      if (V == EmptySlot) {
+        if (T->Count.load(std::memory_order_relaxed) * 4 >= (T->Mask + 1) * 3) {
+          grow(Sh, T);
+          break;
+        }
+        // the id is only wasted if another thread wins the same string
+        if (NewId == InvalidId)
+          NewId = newEntry(S);
+        if (T->Slots[Pos].compare_exchange_strong(V, packSlot(Hash, NewId),
+                                                  std::memory_order_acq_rel)) {
+          T->Count.fetch_add(1, std::memory_order_relaxed);
+          return NewId;
+        }
+        // lost the slot, V now holds whoever won it
+      }
+
+      if (V == FrozenSlot) {
+        waitGrow(Sh);
+        break;
+      }
+
+      if (matches(V, Hash, S))
+        return slotId(V);
+
+      Pos = (Pos + 1) & T->Mask;
+    }
+  }
+}
+
+StrId StringInterner::lookup(StringRef S) const {
+  uint64_t H = xxHash64(S);
+  uint32_t Hash = (uint32_t)H;
+  Shard &Sh = const_cast<Shard &>(Shards[H >> (64 - ShardBits)]);
+
+  while (true) {
+    Table *T = Sh.Cur.load(std::memory_order_acquire);
+    uint64_t Pos = Hash & T->Mask;
+
+    while (true) {
+      uint64_t V = T->Slots[Pos].load(std::memory_order_acquire);
+      if (V == EmptySlot)
+        return InvalidId;
+      if (V == FrozenSlot)
+        break;
+      if (matches(V, Hash, S))
+        return slotId(V);
+      Pos = (Pos + 1) & T->Mask;
+    }
+
+    waitGrow(Sh);
+  }
+}
@@ -0,0 +1,96 @@
+#ifndef _STRING_INTERNER_H
+#define _STRING_INTERNER_H
+
+#include <llvm/ADT/StringRef.h>
+
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+typedef uint32_t StrId;
+
+// Process-wide string interner. Strings map to dense, stable 32-bit ids and
+// their bytes live in an append-only arena, so a StringRef obtained from
+// str() stays valid for the lifetime of the process.
+//
+// The table is split into shards, each an open-addressing array of packed
+// (hash, id) words. Inserts claim an empty slot with a single CAS and
+// lookups never take a lock. Only growing a shard serializes, on that
+// shard alone: the grower freezes every slot of the old array, rehashes
+// into a bigger one and publishes it; anyone who runs into a frozen slot
+// waits for the new array and retries there.
+class StringInterner {
+public:
+  static const StrId InvalidId = ~0u;
+
+  StringInterner();
+  ~StringInterner();
+
+  StrId intern(llvm::StringRef S);
+  // InvalidId if S was never interned
+  StrId lookup(llvm::StringRef S) const;
+  llvm::StringRef str(StrId Id) const;
+  size_t size() const { return NextId.load(std::memory_order_relaxed); }
+
+  static StringInterner &global();
+
+private:
+  struct Entry {
+    const char *Data;
+    uint32_t Len;
+  };
+
+  struct Table {
+    uint64_t Mask;
+    std::atomic<uint32_t> Count;
+    std::atomic<uint64_t> *Slots;
+  };
+
+  struct Shard {
+    std::atomic<Table *> Cur;
+    std::mutex GrowLock;
+    std::vector<Table *> Retired;
+  };
+
+  struct Block {
+    Block *Next;
+    size_t Cap;
+    std::atomic<size_t> Used;
+    char *Data;
+  };
+
+  static const unsigned ShardBits = 6;
+  static const unsigned NumShards = 1u << ShardBits;
+  static const unsigned ChunkBits = 16;
+  static const unsigned NumChunks = 1u << (32 - ChunkBits);
+
+  static Table *newTable(uint64_t Cap);
+  static void freeTable(Table *T);
+
+  bool matches(uint64_t Slot, uint32_t Hash, llvm::StringRef S) const;
+  void grow(Shard &Sh, Table *T);
+  void waitGrow(Shard &Sh) const;
+  StrId newEntry(llvm::StringRef S);
+  const char *allocBytes(size_t Len);
+
+  Shard Shards[NumShards];
+  std::atomic<Entry *> Chunks[NumChunks];
+  std::atomic<uint32_t> NextId;
+  std::atomic<Block *> Arena;
+};
+
+static inline StrId internStr(llvm::StringRef S) {
+  return StringInterner::global().intern(S);
+}
+
+// InvalidId unless S was interned, for lookups that mustn't add it
+static inline StrId lookupStr(llvm::StringRef S) {
+  return StringInterner::global().lookup(S);
+}
+
+static inline llvm::StringRef internedStr(StrId Id) {
+  return StringInterner::global().str(Id);
+}
+
+#endif
@@ -7,11 +7,13 @@
  * For licensing details see LICENSE
  */
 
+#include <llvm/IR/DebugInfo.h>
 #include <llvm/IR/TypeFinder.h>
 #include <llvm/Support/raw_ostream.h>
 
 #include "Annotation.h"
 #include "StructAnalyzer.h"
+#include "ThreadPool.h"
 
 using namespace llvm;
 
@@ -33,7 +35,7 @@ void StructAnalyzer::addContainer(const StructType *container,
       subType = arrayType->getElementType();
     if (const StructType *structType = dyn_cast<StructType>(subType)) {
       if (!structType->isLiteral()) {
-        auto real = structMap.find(getScopeName(structType, M));
+        auto real = structMap.find(lookupStr(getScopeName(structType, M)));
         if (real != structMap.end())
           structType = real->second;
       }
@@ -53,11 +55,50 @@ void StructAnalyzer::addContainer(const StructType *container,
   }
 }
 
+// instances recorded per embedded array, enough to see the pattern
+static const uint64_t MaxEmbeddedInstances = 64;
+
+void StructAnalyzer::addEmbeddedStructs(const StructType *st, const Module *M,
+                                        const DataLayout *layout) {
+  const StructLayout *stLayout =
+      layout->getStructLayout(const_cast<StructType *>(st));
+
+  for (unsigned i = 0; i < st->getNumElements(); ++i) {
+    Type *subType = st->getElementType(i);
+    uint64_t offset = stLayout->getElementOffset(i);
+
+    // every element of a (nested) array is an instance of its own
+    uint64_t count = 1;
+    while (auto *arrayType = dyn_cast<ArrayType>(subType)) {
+      count *= arrayType->getNumElements();
+      subType = arrayType->getElementType();
+    }
+
+    auto *structType = dyn_cast<StructType>(subType);
+    if (!structType || structType->isOpaque())
+      continue;
+    uint64_t stride = layout->getTypeAllocSize(structType);
+
+    const StructType *real = structType;
+    if (!structType->isLiteral()) {
+      auto itr = structMap.find(lookupStr(getScopeName(structType, M)));
+      if (itr != structMap.end())
+        real = itr->second;
+    }
+    auto itr = structInfoMap.find(real);
+    if (itr == structInfoMap.end())
+      continue;
+
+    for (uint64_t n = 0; n < std::min(count, MaxEmbeddedInstances); ++n)
+      itr->second.addContainer(st, offset + n * stride);
+  }
+}
+
 StructInfo &StructAnalyzer::computeStructInfo(const StructType *st,
                                               const Module *M,
                                               const DataLayout *layout) {
   if (!st->isLiteral()) {
-    auto real = structMap.find(getScopeName(st, M));
+    auto real = structMap.find(lookupStr(getScopeName(st, M)));
     if (real != structMap.end())
       st = real->second;
   }
@@ -86,7 +127,7 @@ StructInfo &StructAnalyzer::addStructInfo(const StructType *st, const Module *M,
   currentOffset = 0;
   for (auto subType : st->elements()) {
     if (auto *structType = dyn_cast<StructType>(subType)) {
-      if (structType->getName() == "struct.refcount_struct") {
+      if (getStructName(structType) == "struct.refcount_struct") {
         stInfo.hasRefcount = true;
         stInfo.refcountOffset = currentOffset;
       }
@@ -95,7 +136,7 @@ StructInfo &StructAnalyzer::addStructInfo(const StructType *st, const Module *M,
       if (isa<FunctionType>(baseType)) {
         stInfo.hasFuncPtr = true;
         stInfo.funcPtrOffset.push_back(currentOffset);
-        KA_LOGS(2, "Found function ptr in " << st->getName() << " at "
+        KA_LOGS(2, "Found function ptr in " << getStructName(st) << " at "
                                             << currentOffset << "\n");
       }
     }
@@ -106,6 +147,40 @@ StructInfo &StructAnalyzer::addStructInfo(const StructType *st, const Module *M,
     stInfo.isFuncTable = true;
   }
 
+  // flattened layout: embedded structs are expanded in place (the first
+  // element for arrays of them), every other element, unions included,
+  // stays a single field
+  for (unsigned i = 0; i < st->getNumElements(); ++i) {
+    Type *subType = st->getElementType(i);
+    uint64_t offset = stLayout->getElementOffset(i);
+    bool isArray = false;
+    Type *baseType = subType;
+    while (auto *arrayType = dyn_cast<ArrayType>(baseType)) {
+      isArray = true;
+      baseType = arrayType->getElementType();
+    }
+
+    stInfo.addOffsetMap(stInfo.getExpandedSize());
+    auto *structType = dyn_cast<StructType>(baseType);
+    bool isUnion = structType && !structType->isLiteral() &&
+                   getStructName(structType).startswith("union.");
+    if (structType && !isUnion && !structType->isOpaque() &&
+        structType->getNumElements() > 0) {
+      StructInfo &subInfo = computeStructInfo(structType, M, layout);
+      stInfo.appendElementType(subInfo);
+      stInfo.addFieldOffset(offset);
+      stInfo.appendFields(subInfo);
+      stInfo.appendFieldOffset(subInfo);
+      continue;
+    }
+
+    stInfo.addElementType(stInfo.getExpandedSize(),
+                          isUnion ? baseType : subType);
+    stInfo.addField(1, isArray, subType->isPointerTy(), isUnion);
+    stInfo.addFieldOffset(offset);
+    stInfo.addRealSize(layout->getTypeAllocSize(subType));
+  }
+
   stInfo.setRealType(st);
   stInfo.setDataLayout(layout);
   stInfo.setModule(M);
@@ -122,6 +197,7 @@ StructInfo::updateMaxStruct(st, numField);
 // We adopt the approach proposed by Pearce et al. in the paper "efficient
 // field-sensitive pointer analysis of C"
 void StructAnalyzer::run(Module *M, const DataLayout *layout) {
+  std::vector<const StructType *> added;
   TypeFinder usedStructTypes;
   usedStructTypes.run(*M, false);
   for (TypeFinder::iterator itr = usedStructTypes.begin(),
@@ -132,14 +208,244 @@ void StructAnalyzer::run(Module *M, const DataLayout *layout) {
     // handle non-literal first
     if (st->isLiteral()) {
       addStructInfo(st, M, layout);
+      added.push_back(st);
       continue;
     }
 
     // only add non-opaque type
     if (!st->isOpaque()) {
       // process new struct only
-      if (structMap.insert(std::make_pair(getScopeName(st, M), st)).second)
+      if (structMap.insert(std::make_pair(internStr(getScopeName(st, M)), st))
+              .second) {
         addStructInfo(st, M, layout);
+        added.push_back(st);
+      }
+    }
+  }
+
+  // every embedded type has its info by now
+  for (const StructType *st : added)
+    addEmbeddedStructs(st, M, layout);
+
+  addDITypes(M);
+}
+
+void StructAnalyzer::addDITypes(Module *M) {
+  DebugInfoFinder finder;
+  finder.processModule(*M);
+  for (DIType *T : finder.types()) {
+    // typedef'd anonymous structs are named after the typedef in the IR
+    StringRef name = T->getName();
+    if (auto *DT = dyn_cast<DIDerivedType>(T)) {
+      if (DT->getTag() != dwarf::DW_TAG_typedef)
+        continue;
+      auto *base = dyn_cast_or_null<DICompositeType>(DT->getBaseType());
+      if (!base || !base->getName().empty())
+        continue;
+      T = base;
+    }
+
+    auto *CT = dyn_cast<DICompositeType>(T);
+    if (!CT || name.empty() || CT->isForwardDecl())
+      continue;
+    if (CT->getTag() == dwarf::DW_TAG_structure_type)
+      diTypes.insert(std::make_pair(internStr("struct." + name.str()), CT));
+    else if (CT->getTag() == dwarf::DW_TAG_union_type)
+      diTypes.insert(std::make_pair(internStr("union." + name.str()), CT));
+  }
+}
+
+const DICompositeType *
+StructAnalyzer::getDIType(const std::string &name) const {
+  StrId id = StringInterner::global().lookup(name);
+  if (id == StringInterner::InvalidId)
+    return nullptr;
+  auto itr = diTypes.find(id);
+  return itr == diTypes.end() ? nullptr : itr->second;
+}
+
+// the struct, union or enum behind typedefs, qualifiers and arrays
+static const DICompositeType *getDIComposite(const DIType *T) {
+  while (T) {
+    if (auto *CT = dyn_cast<DICompositeType>(T)) {
+      if (CT->getTag() != dwarf::DW_TAG_array_type)
+        return CT;
+      T = CT->getBaseType();
+    } else if (auto *DT = dyn_cast<DIDerivedType>(T)) {
+      if (DT->getTag() == dwarf::DW_TAG_pointer_type ||
+          DT->getTag() == dwarf::DW_TAG_reference_type)
+        return nullptr;
+      T = DT->getBaseType();
+    } else {
+      return nullptr;
+    }
+  }
+  return nullptr;
+}
+
+// member type spelled as in C
+static std::string getDITypeName(const DIType *T) {
+  if (!T)
+    return "void";
+  if (auto *DT = dyn_cast<DIDerivedType>(T)) {
+    if (DT->getTag() == dwarf::DW_TAG_pointer_type)
+      return getDITypeName(DT->getBaseType()) + "*";
+    if (DT->getTag() == dwarf::DW_TAG_typedef)
+      return DT->getName().str();
+    return getDITypeName(DT->getBaseType());
+  }
+  if (auto *CT = dyn_cast<DICompositeType>(T)) {
+    std::string name = CT->getName().empty() ? "<anon>" : CT->getName().str();
+    switch (CT->getTag()) {
+    case dwarf::DW_TAG_structure_type:
+      return "struct " + name;
+    case dwarf::DW_TAG_union_type:
+      return "union " + name;
+    case dwarf::DW_TAG_enumeration_type:
+      return "enum " + name;
+    case dwarf::DW_TAG_array_type:
+      return getDITypeName(CT->getBaseType()) + "[]";
+    default:
+      return name;
+    }
+  }
+  if (isa<DISubroutineType>(T))
+    return "fn";
+  return T->getName().str();
+}
+
+// the union starting at byte offset target of CT, looked up through the
+// embedded structs
+static const DICompositeType *findDIUnion(const DICompositeType *CT,
+                                          uint64_t target) {
+  for (DINode *E : CT->getElements()) {
+    auto *member = dyn_cast_or_null<DIDerivedType>(E);
+    if (!member || member->getTag() != dwarf::DW_TAG_member ||
+        member->isStaticMember())
+      continue;
+    const DICompositeType *sub = getDIComposite(member->getBaseType());
+    if (!sub)
+      continue;
+    uint64_t offset = member->getOffsetInBits() / 8;
+    uint64_t size = sub->getSizeInBits() / 8;
+    if (target < offset || target >= offset + std::max<uint64_t>(size, 1))
+      continue;
+    if (target == offset && sub->getTag() == dwarf::DW_TAG_union_type)
+      return sub;
+    if (const DICompositeType *found = findDIUnion(sub, target - offset))
+      return found;
+  }
+  return nullptr;
+}
+
+void StructAnalyzer::collectUnions(StructInfo &info) const {
+  info.unions.clear();
+  const DICompositeType *outer = getDIType(info.name);
+
+  for (unsigned i = 0; i < info.getExpandedSize(); ++i) {
+    if (!info.isFieldUnion(i))
+      continue;
+    const StructType *unionType = nullptr;
+    for (const Type *T : info.getElementType(i)) {
+      auto *st = dyn_cast<StructType>(T);
+      if (st && !st->isLiteral() && getStructName(st).startswith("union."))
+        unionType = st;
+    }
+    if (!unionType)
+      continue;
+
+    StructInfo::UnionOverlap overlap;
+    overlap.offset = info.getFieldOffset(i);
+    overlap.size = info.getDataLayout()->getTypeAllocSize(
+        const_cast<StructType *>(unionType));
+    // anonymous unions keep no name worth printing
+    overlap.type = getStructName(unionType).startswith("union.anon")
+                       ? "union.anon"
+                       : getScopeName(unionType, nullptr);
+
+    // through the outer struct, anonymous unions have no name to go by
+    const DICompositeType *U = outer ? findDIUnion(outer, overlap.offset)
+                                     : nullptr;
+    if (!U)
+      U = getDIType(overlap.type);
+
+    if (U) {
+      for (DINode *E : U->getElements()) {
+        auto *member = dyn_cast_or_null<DIDerivedType>(E);
+        if (!member || member->getTag() != dwarf::DW_TAG_member)
+          continue;
+        std::string name =
+            member->getName().empty() ? "<anon>" : member->getName().str();
+        overlap.members.push_back(
+            std::make_pair(name, getDITypeName(member->getBaseType())));
+      }
+    } else {
+      // the IR only keeps the largest member
+      for (Type *T : unionType->elements()) {
+        std::string type;
+        raw_string_ostream OS(type);
+        T->print(OS);
+        overlap.members.push_back(std::make_pair("?", OS.str()));
+      }
+    }
+    info.unions.push_back(overlap);
+  }
+}
+
+void StructAnalyzer::computeUnionOverlaps(WorkStealingPool *pool) {
+  std::vector<StructInfo *> infos;
+  for (auto &mapping : structInfoMap) {
+    const StructType *st = mapping.first;
+    if (st->isLiteral() || getStructName(st).startswith("union."))
+      continue;
+    infos.push_back(&mapping.second);
+  }
+
+  // each task only writes the info it was handed
+  auto sweep = [this, &infos](size_t i, unsigned) {
+    collectUnions(*infos[i]);
+  };
+  if (pool) {
+    pool->parallelFor(infos.size(), sweep);
+  } else {
+    for (size_t i = 0; i < infos.size(); ++i)
+      sweep(i, 0);
+  }
+}
+
+void StructAnalyzer::propagateCacheResidency(const CacheInventory *inv) {
+  // seed with the caches structs are allocated from
+  for (auto &mapping : structInfoMap) {
+    StructInfo &info = mapping.second;
+    info.residency.clear();
+    if (!info.hasAllocSites())
+      continue;
+    std::string cache = info.getAllocCache(inv);
+    if (!cache.empty())
+      info.residency[cache].insert(0);
+  }
+
+  // a single top-down pass, containers are settled before their members
+  std::set<const StructType *> done;
+  for (auto &mapping : structInfoMap)
+    pullResidency(mapping.second, done);
+}
+
+void StructAnalyzer::pullResidency(StructInfo &info,
+                                   std::set<const StructType *> &done) {
+  // marked before recursing, so a malformed cycle can't loop
+  if (!done.insert(info.stType).second)
+    return;
+
+  for (auto &item : info.containers) {
+    auto itr = structInfoMap.find(item.first);
+    if (itr == structInfoMap.end())
+      continue;
+    StructInfo &container = itr->second;
+    pullResidency(container, done);
+    for (auto &res : container.residency) {
+      for (uint64_t offset : res.second)
+        info.residency[res.first].insert(offset + item.second);
     }
   }
 }
@@ -154,7 +460,7 @@ StructInfo *StructAnalyzer::getStructInfo(const StructType *st, Module *M) {
     return &(itr->second);
 
   if (!st->isLiteral()) {
-    auto real = structMap.find(getScopeName(st, M));
+    auto real = structMap.find(lookupStr(getScopeName(st, M)));
     // assert(real != structMap.end() && "Cannot resolve opaque struct");
     if (real != structMap.end()) {
       st = real->second;
@@ -172,11 +478,29 @@ StructInfo *StructAnalyzer::getStructInfo(const StructType *st, Module *M) {
     return &(itr->second);
 }
 
+const StructInfo *StructAnalyzer::getStructInfo(const std::string &name) const {
+  // a name never interned is no struct, and stays out of the interner
+  StrId id = lookupStr(name);
+  if (id == StringInterner::InvalidId)
+    return nullptr;
+  auto real = structMap.find(id);
+  if (real == structMap.end())
+    return nullptr;
+
+  auto itr = structInfoMap.find(real->second);
+  if (itr == structInfoMap.end())
+    return nullptr;
+  return &(itr->second);
+}
+
 bool StructAnalyzer::getContainer(std::string stid, const Module *M,
                                   std::set<std::string> &out) const {
   bool ret = false;
 
-  auto real = structMap.find(stid);
+  StrId id = lookupStr(stid);
+  if (id == StringInterner::InvalidId)
+    return ret;
+  auto real = structMap.find(id);
   if (real == structMap.end())
     return ret;
 
@@ -187,7 +511,7 @@ bool StructAnalyzer::getContainer(std::string stid, const Module *M,
     const StructType *container = container_pair.first;
     if (container->isLiteral())
       continue;
-    std::string id = container->getStructName().str();
+    std::string id = getStructName(container).str();
     if (id.find("struct.anon") == 0 || id.find("union.anon") == 0) {
       // anon struct, get its parent instead
       id = getScopeName(container, M);
@@ -206,7 +530,7 @@ void StructAnalyzer::printStructInfo() const {
   for (auto const &mapping : structInfoMap) {
     errs() << "Struct " << mapping.first << " ";
     if (!mapping.first->isLiteral())
-      errs() << mapping.first->getStructName().str();
+      errs() << getStructName(mapping.first).str();
     errs() << ": sz <";
     const StructInfo &info = mapping.second;
     for (auto sz : info.fieldSize)
@@ -247,7 +571,7 @@ void StructAnalyzer::printFlexibleSt() const {
     }
     // errs() << "Struct " << mapping.first << " ";
     if (!mapping.first->isLiteral()) {
-      string name = mapping.first->getStructName().str();
+      string name = getStructName(mapping.first).str();
 
       if (name.find("struct") != 0) {
         continue;
@@ -271,7 +595,7 @@ void StructAnalyzer::printFuncPtrSt() const {
     }
     // errs() << "Struct " << mapping.first << " ";
     if (!mapping.first->isLiteral()) {
-      string name = mapping.first->getStructName().str();
+      string name = getStructName(mapping.first).str();
 
       if (name.find("struct") != 0) {
         continue;
@@ -299,7 +623,7 @@ void StructAnalyzer::printFuncTableSt() const {
     }
     // errs() << "Struct " << mapping.first << " ";
     if (!mapping.first->isLiteral()) {
-      string name = mapping.first->getStructName().str();
+      string name = getStructName(mapping.first).str();
 
       if (name.find("struct") != 0) {
         continue;
@@ -323,7 +647,7 @@ void StructAnalyzer::printRefcntSt() const {
     }
     // errs() << "Struct " << mapping.first << " ";
     if (!mapping.first->isLiteral()) {
-      string name = mapping.first->getStructName().str();
+      string name = getStructName(mapping.first).str();
 
       if (name.find("struct") != 0) {
         continue;
@@ -347,7 +671,7 @@ void StructAnalyzer::printCopyinSt() const {
     }
     // errs() << "Struct " << mapping.first << " ";
     if (!mapping.first->isLiteral()) {
-      string name = mapping.first->getStructName().str();
+      string name = getStructName(mapping.first).str();
 
       if (name.find("struct") != 0) {
         continue;
@@ -386,7 +710,7 @@ void StructAnalyzer::printCopyoutSt() const {
     }
     // errs() << "Struct " << mapping.first << " ";
     if (!mapping.first->isLiteral()) {
-      string name = mapping.first->getStructName().str();
+      string name = getStructName(mapping.first).str();
 
       if (name.find("struct") != 0) {
         continue;
@@ -426,7 +750,7 @@ void StructAnalyzer::printBoundarySt() const {
     }
     // errs() << "Struct " << mapping.first << " ";
     if (!mapping.first->isLiteral()) {
-      string name = mapping.first->getStructName().str();
+      string name = getStructName(mapping.first).str();
 
       if (name.find("struct") != 0) {
         continue;
@@ -453,12 +777,12 @@ void StructAnalyzer::printCredSt() const {
       continue;
     }
 
-    if (!IgnoreAllocation && info.allocSite.size() == 0) {
+    if (!IgnoreAllocation && !info.hasAllocSites()) {
       continue;
     }
     // errs() << "Struct " << mapping.first << " ";
     if (!mapping.first->isLiteral()) {
-      string name = mapping.first->getStructName().str();
+      string name = getStructName(mapping.first).str();
 
       if (name.find("struct") != 0) {
         continue;
@@ -486,12 +810,12 @@ void StructAnalyzer::printCredStInfo() const {
       continue;
     }
 
-    if (!IgnoreAllocation && info.allocSite.size() == 0) {
+    if (!IgnoreAllocation && !info.hasAllocSites()) {
       continue;
     }
     // errs() << "Struct " << mapping.first << " ";
     if (!mapping.first->isLiteral()) {
-      string name = mapping.first->getStructName().str();
+      string name = getStructName(mapping.first).str();
 
       if (name.find("struct") != 0) {
         continue;
@@ -544,7 +868,7 @@ void StructAnalyzer::printAllCredStInfo() const {
     }
     // errs() << "Struct " << mapping.first << " ";
     if (!mapping.first->isLiteral()) {
-      string name = mapping.first->getStructName().str();
+      string name = getStructName(mapping.first).str();
 
       if (name.find("struct") != 0) {
         continue;
@@ -586,43 +910,157 @@ void StructAnalyzer::printAllCredStInfo() const {
   errs() << "----------Print Cred Structure Done--------\n\n";
 }
 
-void StructAnalyzer::printAllStructsAndAllocCaches() const {
-  // errs() << "----------Print All Structures------------\n";
+void StructAnalyzer::forEachAllocatedStruct(
+    std::function<void(const std::string &, const StructInfo &)> fn) const {
+  // by name, the map order follows where the types were allocated
+  std::vector<std::pair<std::string, const StructInfo *>> rows;
   for (auto const &mapping : structInfoMap) {
     const StructInfo &info = mapping.second;
-    // errs() << "Struct " << mapping.first << " ";
-    if (!mapping.first->isLiteral()) {
-      // Get all required variables
-      string name = mapping.first->getStructName().str();
-      auto structname = name.substr(7);
-      auto allocsz = info.getAllocSize();
-      if (name.find("struct") != 0)
-        continue;
-      if (name.find("struct.anon") == 0)
-        continue;
-      
-      bool alloc_site_found = false;
-      bool is_kmem_cache_alloc = false;
-      for (auto CI : info.allocSite) { if (!CI->getFunction()) continue; alloc_site_found = true;// }
-      is_kmem_cache_alloc = CI->getCalledFunction()->getName().str().find("cache") != string::npos;}
-
-
-      if ( alloc_site_found ) {// && is_kmem_cache_alloc ) {   
-        errs() << structname << "," << info.getAllocCache() << "\n";
-      //   // errs() << "Struct: " << structname << "\n";
-      //   // errs() << "\tallocation site (size: " << allocsz << "):\n";
-      //   // for (auto CI : info.allocSite) {
-      //   //   if (!CI->getFunction())
-      //   //     continue;
-      //   //   errs() << CI->getCalledFunction()->getName() << " (num.arguments "
-      //   //     << CI->getCalledFunction()->arg_size() <<")" << " in "
-      //   //     << CI->getFunction()->getName() << " (num.arguments "
-      //   //     << CI->getFunction()->arg_size() <<")" << "\n";
-      //   //     errs() << "\tallocation cache ---> " <<
-      //   //     info.getAllocCache(CI->getCalledFunction()->getName().str(),CI->getFunction()->getName().str()) << " <---\n";
-      //   // }
-      }
-    }
-  }
-  // errs() << "----------Print All Structures Done--------\n\n";
-}
\ No newline at end of file
+    if (mapping.first->isLiteral())
+      continue;
+
+    string name = getStructName(mapping.first).str();
+    if (name.find("struct") != 0)
+      continue;
+    if (name.find("struct.anon") == 0)
+      continue;
+
+    bool alloc_site_found = !info.allocFacts.empty();
+    for (auto CI : info.allocSite) {
+      if (CI->getFunction()) {
+        alloc_site_found = true;
+        break;
+      }
+    }
+
+    if (alloc_site_found)
+      rows.push_back(std::make_pair(name.substr(7), &info));
+  }
+
+  std::stable_sort(rows.begin(), rows.end(),
+                   [](const std::pair<std::string, const StructInfo *> &a,
+                      const std::pair<std::string, const StructInfo *> &b) {
+                     return a.first < b.first;
+                   });
+  for (auto &row : rows)
+    fn(row.first, *row.second);
+}
+
+void StructAnalyzer::printCacheResidency() const {
+  // sorted by name, the map is keyed by pointer
+  std::map<std::string, const StructInfo *> rows;
+  for (auto const &mapping : structInfoMap) {
+    if (mapping.first->isLiteral() || mapping.second.residency.empty())
+      continue;
+    StringRef name = getStructName(mapping.first);
+    if (name.startswith("struct.anon") || name.startswith("union.anon"))
+      continue;
+    if (name.startswith("struct."))
+      name = name.substr(7);
+    else if (!name.startswith("union."))
+      continue;
+    rows[name.str()] = &mapping.second;
+  }
+
+  for (auto &row : rows) {
+    for (auto &res : row.second->residency) {
+      errs() << row.first << "," << res.first << ",";
+      bool first = true;
+      for (uint64_t offset : res.second) {
+        errs() << (first ? "" : ";") << offset;
+        first = false;
+      }
+      errs() << "\n";
+    }
+  }
+}
+
+void StructAnalyzer::printAllStructsAndAllocCaches(bool usercopy) const {
+  forEachAllocatedStruct([this, usercopy](const std::string &structname,
+                                          const StructInfo &info) {
+    UsercopyWindow window;
+    errs() << structname << "," << info.getAllocCache(cacheInventory, &window);
+    if (usercopy) {
+      errs() << ",";
+      printCacheField(errs(), window.offset);
+      errs() << ",";
+      printCacheField(errs(), window.size);
+    }
+    errs() << "\n";
+  });
+}
+
+void StructAnalyzer::printUnionOverlaps() const {
+  struct Row {
+    std::string cache, name;
+    uint64_t offset;
+    const StructInfo::UnionOverlap *overlap;
+    // of the struct the row is printed for
+    uint64_t size;
+    bool operator<(const Row &other) const {
+      return std::tie(cache, name, offset) <
+             std::tie(other.cache, other.name, other.offset);
+    }
+  };
+
+  std::vector<Row> rows;
+  for (auto const &mapping : structInfoMap) {
+    const StructInfo &info = mapping.second;
+    if (mapping.first->isLiteral() || info.unions.empty())
+      continue;
+    StringRef name = getStructName(mapping.first);
+    if (!name.startswith("struct.") || name.startswith("struct.anon"))
+      continue;
+    name = name.substr(7);
+    auto *st = const_cast<StructType *>(mapping.first);
+    uint64_t size =
+        info.getDataLayout()->getStructLayout(st)->getSizeInBytes();
+
+    // embedded instances when residency is known, else the own cache
+    std::map<std::string, std::set<uint64_t>> caches = info.residency;
+    if (caches.empty() && info.hasAllocSites()) {
+      std::string cache = info.getAllocCache(cacheInventory);
+      if (!cache.empty())
+        caches[cache].insert(0);
+    }
+
+    for (auto &cache : caches) {
+      for (uint64_t base : cache.second) {
+        for (auto &overlap : info.unions)
+          rows.push_back({cache.first, name.str(), base + overlap.offset,
+                          &overlap, size});
+      }
+    }
+  }
+
+  // the layout of a struct holds the unions of the structs embedded in it,
+  // which are at the same place in the cache. keep the innermost struct's
+  typedef std::tuple<std::string, uint64_t, uint64_t, std::string,
+                     std::vector<std::pair<std::string, std::string>>>
+      Key;
+  std::map<Key, Row> unique;
+  for (auto &row : rows) {
+    Key key(row.cache, row.offset, row.overlap->size, row.overlap->type,
+            row.overlap->members);
+    auto ins = unique.insert(std::make_pair(key, row));
+    Row &kept = ins.first->second;
+    if (!ins.second && std::tie(row.size, row.name) <
+                           std::tie(kept.size, kept.name))
+      kept = row;
+  }
+  rows.clear();
+  for (auto &item : unique)
+    rows.push_back(item.second);
+
+  std::sort(rows.begin(), rows.end());
+  for (auto &row : rows) {
+    errs() << row.cache << "," << row.name << "," << row.offset << ","
+           << row.overlap->size << "," << row.overlap->type << ",";
+    bool first = true;
+    for (auto &member : row.overlap->members) {
+      errs() << (first ? "" : ";") << member.first << ":" << member.second;
+      first = false;
+    }
+    errs() << "\n";
+  }
+}
@@ -1,14 +1,17 @@
 #ifndef STRUCT_ANALYZER_H
 #define STRUCT_ANALYZER_H
 
+#include <llvm/ADT/StringSet.h>
 #include <llvm/ADT/iterator_range.h>
 #include <llvm/IR/DebugInfoMetadata.h>
 #include <llvm/IR/DebugLoc.h>
+#include <llvm/IR/InstVisitor.h>
 #include <llvm/IR/Instructions.h>
 #include <llvm/IR/Module.h>
 #include <llvm/IR/Type.h>
 #include <llvm/Support/raw_ostream.h>
 
+#include <functional>
 #include <map>
 #include <set>
 #include <unordered_map>
@@ -16,12 +19,17 @@
 #include <cmath> // the math to get the closest power of 2
 
 #include "Annotation.h"
+#include "BackwardSlice.h"
+#include "CacheInventory.h"
 #include "Common.h"
+#include "StringInterner.h"
+
+class WorkStealingPool;
 
 using namespace llvm;
 using namespace std;
 
-static const std::set<llvm::StringRef> generic_alloc = {
+static const llvm::StringSet<> generic_alloc = {
   "kmalloc",
   "kzalloc",
   "__kmalloc",
@@ -33,11 +41,75 @@ static const std::set<llvm::StringRef> generic_alloc = {
   "kvzalloc",
   "kvzalloc_node",
 };
-static const std::set<llvm::StringRef> specific_alloc = {
+// allocate from the per-CPU chunks, alloc_percpu() expands to
+// __alloc_percpu(sizeof(type), __alignof__(type))
+static const llvm::StringSet<> percpu_alloc = {
+  "__alloc_percpu",
+  "__alloc_percpu_gfp",
+};
+// stands in for the cache of per-CPU sites, no slab cache is named so
+static const char *const PercpuPlacement = "percpu";
+
+// allocate from the cache behind a mempool or bio_set
+static const llvm::StringSet<> pool_alloc = {
+  "mempool_alloc",
+  "bio_alloc_bioset",
+};
+static const llvm::StringSet<> specific_alloc = {
   "kmem_cache_alloc",
   "kmem_cache_alloc_node",
   "kmem_cache_zalloc",
 };
+// prints the instruction operands of a leak check
+class CmpSrcPrinter : public InstVisitor<CmpSrcPrinter> {
+public:
+  void visitGetElementPtrInst(GetElementPtrInst &GEP) {
+    PointerType *ptrType = dyn_cast<PointerType>(GEP.getPointerOperandType());
+    assert(ptrType != nullptr);
+    Type *baseType = ptrType->getElementType();
+    StructType *stType = dyn_cast<StructType>(baseType);
+    assert(stType != nullptr);
+
+    Module *M = GEP.getParent()->getParent()->getParent();
+    string structName = getScopeName(stType, M);
+
+    ConstantInt *CI = dyn_cast<ConstantInt>(GEP.getOperand(2));
+    assert(CI != nullptr && "GEP's index is not constant");
+    int64_t offset = CI->getSExtValue();
+
+    RES_REPORT("<" << structName << ", " << offset << ">");
+  }
+
+  void visitIntrinsicInst(IntrinsicInst &II) {
+    string name = II.getCalledFunction()->getName().str();
+    RES_REPORT("<Intrinsic, " << name << ">");
+  }
+
+  void visitCallInst(CallInst &CI) {
+    RES_REPORT("<CallInst, ");
+    Function *F = CI.getCalledFunction();
+    if (F == nullptr || !F->hasName()) {
+      CI.print(errs());
+      RES_REPORT(">");
+    } else {
+      string name = F->getName().str();
+      RES_REPORT(name << ">");
+    }
+  }
+
+  void visitBitCastInst(BitCastInst &BCI) {
+    RES_REPORT("<BitCast, ");
+    BCI.print(errs());
+    RES_REPORT(">");
+  }
+
+  void visitInstruction(Instruction &I) {
+    RES_REPORT("<Unknown, ");
+    I.print(errs());
+    RES_REPORT(">"); // it shouldn't happen but it does
+  }
+};
+
 // Every struct type T is mapped to the vectors fieldSize and offsetMap.
 // If field [i] in the expanded struct T begins an embedded struct, fieldSize[i]
 // is the # of fields in the largest such struct, else S[i] = 1. Also, if a
@@ -70,7 +142,7 @@ private:
   const llvm::Module *module;
   void setModule(const llvm::Module *M) { module = M; }
 
-  // container type(s)
+  // container type(s), with the byte offset of each embedded instance
   std::set<std::pair<const llvm::StructType *, unsigned>> containers;
   void addContainer(const llvm::StructType *st, unsigned offset) {
     containers.insert(std::make_pair(st, offset));
@@ -108,12 +180,10 @@ private:
                          (other.fieldRealSize).end());
   }
   void appendFieldOffset(const StructInfo &other) {
+    // the first field of other starts at base, which is already recorded
     unsigned base = fieldOffset.back();
-    for (auto i : other.fieldOffset) {
-      if (i == 0)
-        continue;
-      fieldOffset.push_back(i + base);
-    }
+    for (unsigned i = 1; i < other.fieldOffset.size(); ++i)
+      fieldOffset.push_back(other.fieldOffset[i] + base);
   }
   void addElementType(unsigned field, const llvm::Type *type) {
     elementType[field].insert(type);
@@ -126,7 +196,7 @@ private:
   }
 
   // Must be called after all fields have been analyzed
-  void finalize() {}
+  void finalize() { finalized = true; }
 
   static void updateMaxStruct(const llvm::StructType *st, unsigned structSize) {
     if (structSize > maxStructSize) {
@@ -150,115 +220,247 @@ private:
     return nullptr;
   }
 
-  Instruction* getProducerOfArgument0(Instruction* currentInstruction) const {
-    // Get the operand 0
-    Value* arg0 = currentInstruction->getOperand(0);
+  // the name kmem_cache_create gave the cache, if it is a constant string
+  static std::string getCreatedCacheName(CallInst *create) {
+    Function *F = create->getCalledFunction();
+    if (!F || F->getName().find("kmem_cache_create") == string::npos ||
+        create->arg_size() < 1)
+      return "";
+    auto *nameVar = dyn_cast<GlobalVariable>(
+        create->getArgOperand(0)->stripPointerCasts());
+    if (!nameVar || !nameVar->isConstant() || !nameVar->hasInitializer())
+      return "";
+    auto *chars = dyn_cast<ConstantDataSequential>(nameVar->getInitializer());
+    if (!chars || !chars->isString())
+      return "";
+    return chars->getAsCString().str();
+  }
 
-    // Attempt to cast the operand to an Instruction
-    if (Instruction* producer = dyn_cast<Instruction>(arg0)) return producer;
+  static void setWindow(UsercopyWindow *window, const CacheInfo *cache) {
+    if (window && cache) {
+      window->offset = cache->useroffset;
+      window->size = cache->usersize;
+    }
+  }
 
-    // Initialize iterator to the beginning of the basic block
-    BasicBlock::iterator it = currentInstruction->getParent()->begin();
-    // Traverse the basic block until we reach currentInstruction
-    while (&(*it) != currentInstruction) ++it;
+  // with --local-aa, the cache created in the same function and passed to
+  // CI, through memory as well. it beats the first cache stored to the
+  // location CI loads from
+  static std::string getLocalCache(CallInst *CI, const CacheInventory *inv,
+                                   UsercopyWindow *window) {
+    FuncAACache *AA = inv ? inv->getAliasCache() : nullptr;
+    if (!AA || !AA->enabled())
+      return "";
+    BackwardSlicer slicer(AA);
+    auto *create =
+        dyn_cast_or_null<CallInst>(slicer.getSource(CI->getArgOperand(0)));
+    std::string name = create ? getCreatedCacheName(create) : "";
+    if (!name.empty() && inv)
+      setWindow(window, inv->lookupCreationSite(create));
+    return name;
+  }
 
-    // If it points to the first instruction, return nullptr
-    if (it == currentInstruction->getParent()->begin()) {
-      // errs() << "\n============\n";
-      // currentInstruction->getParent()->print(errs());
-      // errs() << "\n============\n";
-      return nullptr;
+  // the dedicated cache CI allocates from, empty if there is none or it
+  // can't be told. generic is set for kmalloc-like calls
+  std::string getSiteCache(CallInst *CI, const CacheInventory *inv,
+                           UsercopyWindow *window, bool &generic) const {
+    auto allocFunction = CI->getCalledFunction();
+    // a kmalloc wrapper allocates like kmalloc. a kmem_cache wrapper
+    // allocates from its first argument only if it passes it on
+    StringRef api = allocFunction->getName();
+    bool cacheArg = true;
+    if (inv)
+      api = inv->resolveAllocAPI(allocFunction, &cacheArg);
+
+    // not slab at all, the usercopy window doesn't apply
+    if (percpu_alloc.count(api))
+      return PercpuPlacement;
+
+    // INDICATE EXISTANCE OF GENERIC KMALLOC CACHE
+    if (generic_alloc.find(api) != generic_alloc.end()) {
+      // auto argument0 = allocFunction->getArg(0);
+      generic = true;
+    }
+
+    // sockets come from the slab of the protocol passed in, or from
+    // kmalloc if it was registered without one. likewise for pools
+    if ((allocFunction->getName() == "sk_alloc" ||
+         pool_alloc.count(allocFunction->getName())) && inv) {
+      const CacheInfo *cache = inv->lookupAllocSite(CI);
+      if (cache && !cache->name.empty()) {
+        setWindow(window, cache);
+        return cache->name;
+      }
+      if (inv->isKmallocDest(inv->lookupAllocSiteDest(CI)))
+        generic = true;
+      return "";
+    }
+
+    // PARSE THE NAME OF NON-GENERIC CACHE!
+    if (cacheArg && specific_alloc.find(api) != specific_alloc.end()) {
+      std::string local = getLocalCache(CI, inv, window);
+      if (!local.empty())
+        return local;
+
+      if (inv) {
+        const CacheInfo *cache = inv->lookupAllocSite(CI);
+        if (cache && !cache->name.empty()) {
+          setWindow(window, cache);
+          return cache->name;
+        }
+      }
+
+      auto stype = getStructType(allocFunction->getArg(0)->getType());
+      if (!stype || getStructName(stype) != "struct.kmem_cache")
+        return "";
+
+      // the cache comes from kmem_cache_create, in the same function or
+      // through a global it was stored to
+      BackwardSlicer slicer;
+      for (Value *src : slicer.getSources(CI->getArgOperand(0))) {
+        if (auto *create = dyn_cast<CallInst>(src)) {
+          std::string name = getCreatedCacheName(create);
+          if (!name.empty()) {
+            if (inv)
+              setWindow(window, inv->lookupCreationSite(create));
+            return name;
+          }
+          continue;
+        }
+
+        auto *loadInst = dyn_cast<LoadInst>(src);
+        auto *globalVar =
+            loadInst ? dyn_cast<GlobalVariable>(
+                           loadInst->getPointerOperand()->stripPointerCasts())
+                     : nullptr;
+        if (!globalVar)
+          continue;
+        for (auto u : globalVar->users()) {
+          auto *store = dyn_cast<StoreInst>(u);
+          if (!store || store->getPointerOperand() != globalVar)
+            continue;
+          for (Value *stored : slicer.getSources(store->getValueOperand())) {
+            auto *create = dyn_cast<CallInst>(stored);
+            std::string name = create ? getCreatedCacheName(create) : "";
+            if (name.empty())
+              continue;
+            if (inv)
+              setWindow(window, inv->lookupCreationSite(create));
+            return name;
+          }
+        }
+      }
     }
-    
-    // Return the instruction before currentInstruction
-    --it;
-    return &(*it);
+    return "";
   }
 
 public:
-  std::string getAllocCache() const {
-    auto allocSize = getAllocSize();
+  // caches found by the forward discovery in inv take precedence over the
+  // backward search from the allocation site. window receives the usercopy
+  // whitelist of the cache, left unknown when it can't be told
+  std::string getAllocCache(const CacheInventory *inv = nullptr,
+                            UsercopyWindow *window = nullptr) const {
     bool found_generic_alloc = false;
+    // slab sites win over per-CPU ones, also when their cache is unknown
+    bool found_percpu_alloc = false;
+    bool found_slab_alloc = false;
+    if (window)
+      *window = UsercopyWindow();
 
     for (auto CI : allocSite) {
-      auto allocFunction = CI->getCalledFunction();
+      std::string cache = getSiteCache(CI, inv, window, found_generic_alloc);
+      if (cache == PercpuPlacement)
+        found_percpu_alloc = true;
+      else if (!cache.empty())
+        return cache;
+      else
+        found_slab_alloc = true;
+    }
+    for (auto &fact : allocFacts) {
+      found_generic_alloc |= fact.generic;
+      const CacheInfo *cache = inv && fact.dest != StringInterner::InvalidId
+                                   ? inv->lookup(fact.dest)
+                                   : nullptr;
+      if (cache && !cache->name.empty()) {
+        setWindow(window, cache);
+        return cache->name;
+      }
+      if (fact.cache == PercpuPlacement) {
+        found_percpu_alloc = true;
+      } else if (!fact.cache.empty()) {
+        if (window)
+          *window = fact.window;
+        return fact.cache;
+      } else {
+        found_slab_alloc = true;
+      }
+    }
+
+    if (found_generic_alloc)
+      return getKmallocCache(window);
+    else if (found_percpu_alloc && !found_slab_alloc)
+      return PercpuPlacement;
+    else {return "";}
+  }
+
+  // the kmalloc size class the struct falls into
+  std::string getKmallocCache(UsercopyWindow *window = nullptr) const {
+    return getKmallocSizeClass(getAllocSize(), window);
+  }
 
-      // INDICATE EXISTANCE OF GENERIC KMALLOC CACHE
-      if (generic_alloc.find(allocFunction->getName()) != generic_alloc.end()) {
-        // auto argument0 = allocFunction->getArg(0);
-        found_generic_alloc = true;
+  static std::string getKmallocSizeClass(uint64_t allocSize,
+                                         UsercopyWindow *window = nullptr) {
+    int i = 3;
+    while (pow(2,i) < allocSize) i++;
+    auto largerAlloc = static_cast<uint64_t>(pow(2,i));
+    // kmalloc caches whitelist the whole object
+    auto kmalloc = [window](const std::string &name, uint64_t size) {
+      if (window) {
+        window->offset = 0;
+        window->size = size;
       }
+      return name;
+    };
+    // kmalloc-1k and up are named in KiB
+    if (largerAlloc >= 1024)
+      return kmalloc("kmalloc-" + std::to_string(largerAlloc / 1024) + "k",
+                     largerAlloc);
+    return kmalloc("kmalloc-" + std::to_string(largerAlloc), largerAlloc);
+  }
 
-      // PARSE THE NAME OF NON-GENERIC CACHE!
-      if (specific_alloc.find(allocFunction->getName()) != specific_alloc.end()) {
-        llvm::LoadInst *loadInst = nullptr;
-        // llvm::StoreInst *storeInst = nullptr;
-        auto stype = getStructType(allocFunction->getArg(0)->getType());
-        llvm::GlobalVariable *globalVar = llvm::dyn_cast<llvm::GlobalVariable>(allocFunction->getArg(0));
-        
-        auto previousInstruction = getProducerOfArgument0(CI);
-        if (previousInstruction) {
-          loadInst = llvm::dyn_cast<llvm::LoadInst>(previousInstruction);
-          // storeInst = llvm::dyn_cast<llvm::StoreInst>(previousInstruction);
-        } else { continue; }
-
-        auto arg0 = allocFunction->getArg(0);
-        if (stype && allocFunction->getArg(0)->getType()->isPointerTy()) {
-          if (globalVar == nullptr)
-            if (loadInst)
-              globalVar = llvm::dyn_cast<llvm::GlobalVariable>(loadInst->getOperand(0));
-          if (globalVar == nullptr) {
-            // errs() << "STILL NOT GLOBAL VAR!!\n";
-            continue;
-          }
-          // errs() << "\n========== BASIC BLOCK ==========\n";
-          // loadInst->getParent()->print(errs());
-          // errs() << "\n=================================\n";
-
-          if (stype->getName().str() == "struct.kmem_cache") {
-            for (auto u: globalVar->users()) {
-              if (auto kmem_create_store = llvm::dyn_cast<llvm::StoreInst>(u)) {
-                // errs() << "USER OF GLOBAL: ";u->print(errs()); errs() << "\n";
-                if (auto kmem_create_call = llvm::dyn_cast<llvm::CallInst>(kmem_create_store->getOperand(0))) {
-                  if (kmem_create_call->getCalledFunction()->getName().find("kmem_cache_create") != string::npos) {
-                    auto arg0 = kmem_create_call->getArgOperand(0);
-
-                    if (auto *ConstantArg = dyn_cast<ConstantExpr>(arg0)) {
-                      if (ConstantArg->isGEPWithNoNotionalOverIndexing()) {
-                        unsigned NumIndices = ConstantArg->getNumOperands() - 2; // -2 to exclude pointer and offset
-                        Constant *BasePtr = cast<Constant>(ConstantArg->getOperand(0));
-
-                        if (auto *BasePtrValue = dyn_cast<GlobalVariable>(BasePtr)) {
-                          // Check if it's a constant global variable
-                          if (BasePtrValue->isConstant()) {
-                            Constant *Initializer = BasePtrValue->getInitializer();
-                            if (auto *CharArray = dyn_cast<ConstantDataSequential>(Initializer)) {
-                              std::string StrValue = CharArray->getAsCString().str();
-                              return StrValue;
-                            }
-                          }
-                        } //else { errs() << "\tIT\'S NOT GlobalVariable!!! BasePtr: `"; BasePtr->print(errs()); errs() << "`\n"; }
-                      } //else { errs() << "\tIT\'S NOT isGEPWithNoNotionalOverIndexing!!!\n"; }
-                    } //else { errs() << "\tIT\'S NOT ConstantExpr!!! arg0: `"; arg0->print(errs()); errs() << "\n"; }
-                  } //else { errs() << "\tIT\'S NOT kmem_cache_create function! function name: `"; kmem_create_store->getOperand(0)->print(errs()); errs() << "`\n"; }
-                } //else { errs() << "\tIT\'S NOT CallInst!!! kmem_create_store->getOperand(0): `"; kmem_create_store->getOperand(0)->print(errs()); errs() << "` store inst: `"; kmem_create_store->print(errs()); errs() << "`\n"; }
-              } //else { errs() << "\tIT\'S NOT StoreInst!!! global var user: `"; u->print(errs()); errs() << "\n"; }
-            }
-          } //else { errs() << "\tIT\'S NOT `struct.kmem_cache` !!!\n"; }
-        } //else { errs() << " `stype && allocFunction->getArg(0)->getType()->isPointerTy()` returns false!!!"; }
+  // the cache of every allocation site, live or frozen:
+  // fn(module, cache, generic, sites). cache is empty when it can't be
+  // told, sites counts the frozen sites of a module that agree
+  void forEachAllocSite(
+      const CacheInventory *inv,
+      std::function<void(const Module *, const std::string &, bool, unsigned)>
+          fn) const {
+    for (auto CI : allocSite) {
+      if (!CI->getFunction())
+        continue;
+      bool generic = false;
+      std::string cache = getSiteCache(CI, inv, nullptr, generic);
+      if (generic)
+        cache = getKmallocCache();
+      auto itr = siteModules.find(CI);
+      if (itr == siteModules.end()) {
+        fn(CI->getModule(), cache, generic, 1);
+        continue;
       }
+      for (const Module *M : itr->second)
+        fn(M, cache, generic, 1);
+    }
+    for (auto &fact : allocFacts) {
+      const CacheInfo *cache = inv && fact.dest != StringInterner::InvalidId
+                                   ? inv->lookup(fact.dest)
+                                   : nullptr;
+      if (cache && !cache->name.empty())
+        fn(fact.module, cache->name, false, fact.sites);
+      else if (fact.generic)
+        fn(fact.module, getKmallocCache(), true, fact.sites);
+      else
+        fn(fact.module, fact.cache, false, fact.sites);
     }
-    if (found_generic_alloc) {
-      int i = 3;
-      while (pow(2,i) < getAllocSize()) i++;
-      auto largerAlloc = static_cast<uint64_t>(pow(2,i));
-      // if (i >= 8192) return "kmalloc-8k";
-      if (largerAlloc < 8192 && largerAlloc >= 4096) return "kmalloc-8k";
-      if (largerAlloc < 4096 && largerAlloc >= 2048) return "kmalloc-4k";
-      if (largerAlloc < 2048 && largerAlloc >= 1024) return "kmalloc-2k";
-      if (largerAlloc < 1024 && largerAlloc >= 512) return "kmalloc-1k";
-      return "kmalloc-" + std::to_string(static_cast<uint64_t>(pow(2,i)));
-    } else {return "";}
   }
 
   bool isFinalized() { return finalized; }
@@ -303,6 +505,84 @@ public:
   std::set<unsigned> credOffset;
   std::set<CallInst *> credFreeSite;
   std::set<CallInst *> allocSite;
+  // the modules holding a copy of each live site, once per copy. a header
+  // inline's copies replay the site of the first one
+  std::map<CallInst *, std::vector<const Module *>> siteModules;
+
+  // what an allocation site told before its function body was dropped
+  struct AllocFact {
+    bool generic;
+    // where the cache pointer is loaded from, looked up in the inventory
+    // when asked, the cache may be created in a module loaded later
+    StrId dest;
+    // the cache found from the site itself
+    std::string cache;
+    UsercopyWindow window;
+    // where the sites were, and how many of them there were
+    const Module *module;
+    unsigned sites;
+
+    bool operator==(const AllocFact &other) const {
+      return generic == other.generic && dest == other.dest &&
+             cache == other.cache && window.offset == other.window.offset &&
+             window.size == other.window.size && module == other.module;
+    }
+  };
+  std::vector<AllocFact> allocFacts;
+
+  // keep what CI tells as a fact, the body holding it is about to go away
+  void freezeAllocSite(CallInst *CI, const CacheInventory *inv) {
+    if (!allocSite.erase(CI))
+      return;
+    AllocFact fact;
+    fact.generic = false;
+    BackwardSlicer slicer;
+    std::string dest = inv ? inv->lookupAllocSiteDest(CI).str()
+                           : CacheInventory::getAllocSiteDest(CI, slicer);
+    fact.dest = dest.empty() ? StringInterner::InvalidId : internStr(dest);
+    fact.cache = getSiteCache(CI, inv, &fact.window, fact.generic);
+    // the location's cache would be looked up again, and win
+    UsercopyWindow window;
+    if (!getLocalCache(CI, inv, &window).empty())
+      fact.dest = StringInterner::InvalidId;
+    fact.sites = 1;
+    // one fact per module holding a copy
+    std::vector<const Module *> modules{CI->getModule()};
+    auto copies = siteModules.find(CI);
+    if (copies != siteModules.end()) {
+      modules.swap(copies->second);
+      siteModules.erase(copies);
+    }
+    for (const Module *M : modules) {
+      fact.module = M;
+      auto itr = std::find(allocFacts.begin(), allocFacts.end(), fact);
+      if (itr == allocFacts.end())
+        allocFacts.push_back(fact);
+      else
+        ++itr->sites;
+    }
+  }
+
+  bool hasAllocSites() const {
+    return !allocSite.empty() || !allocFacts.empty();
+  }
+
+  // caches the struct lives in, allocated directly or embedded in another
+  // struct, with its byte offsets inside the cache object. filled by
+  // StructAnalyzer::propagateCacheResidency
+  std::map<std::string, std::set<uint64_t>> residency;
+
+  // a union somewhere in the struct, embedded structs included, and the
+  // members sharing its bytes. filled by StructAnalyzer::computeUnionOverlaps
+  struct UnionOverlap {
+    // byte offset inside the struct
+    uint64_t offset;
+    uint64_t size;
+    std::string type;
+    // member name and C type, "?" and the IR type without debug info
+    std::vector<std::pair<std::string, std::string>> members;
+  };
+  std::vector<UnionOverlap> unions;
 
   // external information
   std::string name;
@@ -528,49 +808,17 @@ public:
 
   void dumpCmpSrc(Value *V) {
     RES_REPORT("| ");
-    if (GetElementPtrInst *GEP = dyn_cast<GetElementPtrInst>(V)) {
-      PointerType *ptrType =
-          dyn_cast<PointerType>(GEP->getPointerOperandType());
-      assert(ptrType != nullptr);
-      Type *baseType = ptrType->getElementType();
-      StructType *stType = dyn_cast<StructType>(baseType);
-      assert(stType != nullptr);
-
-      Module *M = GEP->getParent()->getParent()->getParent();
-      string structName = getScopeName(stType, M);
-
-      ConstantInt *CI = dyn_cast<ConstantInt>(GEP->getOperand(2));
-      assert(CI != nullptr && "GEP's index is not constant");
-      int64_t offset = CI->getSExtValue();
-
-      RES_REPORT("<" << structName << ", " << offset << ">");
-
+    if (Instruction *I = dyn_cast<Instruction>(V)) {
+      CmpSrcPrinter().visit(I);
     } else if (ConstantInt *CI = dyn_cast<ConstantInt>(V)) {
       int64_t num = CI->getSExtValue();
       RES_REPORT("<C, " << num << ">");
     } else if (ConstantPointerNull *CPN = dyn_cast<ConstantPointerNull>(V)) {
       RES_REPORT("<C, null>");
-    } else if (IntrinsicInst *II = dyn_cast<IntrinsicInst>(V)) {
-      string name = II->getCalledFunction()->getName().str();
-      RES_REPORT("<Intrinsic, " << name << ">");
-    } else if (CallInst *CI = dyn_cast<CallInst>(V)) {
-      RES_REPORT("<CallInst, ");
-      Function *F = CI->getCalledFunction();
-      if (F == nullptr || !F->hasName()) {
-        CI->print(errs());
-        RES_REPORT(">");
-      } else {
-        string name = F->getName().str();
-        RES_REPORT(name << ">");
-      }
     } else if (Argument *A = dyn_cast<Argument>(V)) {
       RES_REPORT("<Arg, ");
       A->print(errs());
       RES_REPORT(">");
-    } else if (BitCastInst *BCI = dyn_cast<BitCastInst>(V)) {
-      RES_REPORT("<BitCast, ");
-      BCI->print(errs());
-      RES_REPORT(">");
     } else {
       RES_REPORT("<Unknown, ");
       V->print(errs());
@@ -712,15 +960,23 @@ public:
 // Construct the necessary StructInfo from LLVM IR
 // This pass will make GEP instruction handling easier
 class StructAnalyzer {
-private:
+public:
   // Map llvm type to corresponding StructInfo
   typedef std::map<const llvm::StructType *, StructInfo> StructInfoMap;
+
+private:
   StructInfoMap structInfoMap;
 
+  // caches known from their creation sites, if discovered
+  const CacheInventory *cacheInventory = nullptr;
+
   // Map struct name to llvm type
-  typedef std::map<const std::string, const llvm::StructType *> StructMap;
+  typedef std::unordered_map<StrId, const llvm::StructType *> StructMap;
   StructMap structMap;
 
+  // debug info of named structs and unions, keyed like structMap
+  std::unordered_map<StrId, const llvm::DICompositeType *> diTypes;
+
   // Expand (or flatten) the specified StructType and produce StructInfo
   StructInfo &addStructInfo(const llvm::StructType *st, const llvm::Module *M,
                             const llvm::DataLayout *layout);
@@ -732,14 +988,27 @@ private:
   // update container information
   void addContainer(const llvm::StructType *container, StructInfo &containee,
                     unsigned offset, const llvm::Module *M);
+  // record st as container of the structs embedded in it
+  void addEmbeddedStructs(const llvm::StructType *st, const llvm::Module *M,
+                          const llvm::DataLayout *layout);
+  void pullResidency(StructInfo &info,
+                     std::set<const llvm::StructType *> &done);
+  void addDITypes(llvm::Module *M);
+  const llvm::DICompositeType *getDIType(const std::string &name) const;
+  void collectUnions(StructInfo &info) const;
 
 public:
   StructAnalyzer() {}
 
+  void setCacheInventory(const CacheInventory *inv) { cacheInventory = inv; }
+  const CacheInventory *getCacheInventory() const { return cacheInventory; }
+
   // Return NULL if info not found
   // const StructInfo* getStructInfo(const llvm::StructType* st, llvm::Module*
   // M) const;
   StructInfo *getStructInfo(const llvm::StructType *st, llvm::Module *M);
+  const StructInfo *getStructInfo(const std::string &name) const;
+  const StructInfoMap &getStructInfoMap() const { return structInfoMap; }
   size_t getSize() const { return structMap.size(); }
   bool getContainer(std::string stid, const llvm::Module *M,
                     std::set<std::string> &out) const;
@@ -759,7 +1028,26 @@ public:
   void printCredSt() const;
   void printCredStInfo() const;
   void printAllCredStInfo() const;
-  void printAllStructsAndAllocCaches() const;
+  // with usercopy, each row also carries the effective usercopy window
+  void printAllStructsAndAllocCaches(bool usercopy = false) const;
+  // struct,cache,offsets for every cache a struct may live in
+  void printCacheResidency() const;
+  // cache,struct,offset,size,union,members for every union that may sit in
+  // a cache object, offsets are from the start of the object
+  void printUnionOverlaps() const;
+
+  // push the cache of every allocated struct down to the structs embedded
+  // in it, must run after the allocation sites are known
+  void propagateCacheResidency(const CacheInventory *inv);
+
+  // find the unions of every struct from the flattened layouts, one
+  // parallel sweep over the struct table
+  void computeUnionOverlaps(WorkStealingPool *pool);
+
+  // visit every named struct with at least one allocation site by name, the
+  // name passed in has the "struct." prefix stripped
+  void forEachAllocatedStruct(
+      std::function<void(const std::string &, const StructInfo &)> fn) const;
 };
 
 #endif
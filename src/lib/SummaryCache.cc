@@ -0,0 +1,161 @@
+/*
+ * Persistent per-function summaries
+ *
+ * For licensing details see LICENSE
+ */
+
+#include <llvm/IR/InstIterator.h>
+#include <llvm/IR/IntrinsicInst.h>
+#include <llvm/Support/FileSystem.h>
+#include <llvm/Support/Format.h>
+#include <llvm/Support/MemoryBuffer.h>
+#include <llvm/Support/Path.h>
+#include <llvm/Support/Process.h>
+#include <llvm/Support/raw_ostream.h>
+
+#include "SummaryCache.h"
+
+using namespace llvm;
+
+// bump whenever the summarized analyses change what they record
+static const char *SummaryMagic = "kasum 4";
+
+SummaryCache::SummaryCache(const std::string &Dir_)
+    : Dir(Dir_), Hits(0), Misses(0) {
+  if (Dir.empty())
+    return;
+  if (std::error_code EC = sys::fs::create_directories(Dir))
+    errs() << "cannot create summary cache '" << Dir << "': " << EC.message()
+           << "\n";
+}
+
+void getSummaryInsts(Function *F, std::vector<Instruction *> &Insts) {
+  for (inst_iterator i = inst_begin(F), e = inst_end(F); i != e; ++i) {
+    if (!isa<DbgInfoIntrinsic>(&*i))
+      Insts.push_back(&*i);
+  }
+}
+
+FuncSummary *SummaryCache::get(uint64_t H) {
+  std::lock_guard<std::mutex> Guard(Lock);
+  std::unique_ptr<FuncSummary> &S = Summaries[H];
+  if (!S) {
+    S.reset(new FuncSummary());
+    if (load(H, *S)) {
+      ++Hits;
+    } else {
+      *S = FuncSummary();
+      ++Misses;
+    }
+  }
+  return S.get();
+}
+
+void SummaryCache::flush() {
+  if (Dir.empty())
+    return;
+  std::lock_guard<std::mutex> Guard(Lock);
+  for (auto &item : Summaries) {
+    FuncSummary &S = *item.second;
+    if (!S.Dirty)
+      continue;
+    if (!store(item.first, S))
+      errs() << "cannot write summary " << pathOf(item.first) << "\n";
+    S.Dirty = false;
+  }
+}
+
+std::string SummaryCache::pathOf(uint64_t H) const {
+  SmallString<128> Path(Dir);
+  std::string Name;
+  raw_string_ostream OS(Name);
+  OS << format_hex_no_prefix(H, 16) << ".sum";
+  sys::path::append(Path, OS.str());
+  return Path.str().str();
+}
+
+// text format, one record per line:
+//   kasum <version>
+//   site <kind> <call> <type> <arg> <field>   (after a "sites" line)
+//   id <ordinal> <annotation>                 (after an "ids <key>" line)
+bool SummaryCache::load(uint64_t H, FuncSummary &S) const {
+  if (Dir.empty())
+    return false;
+  auto Buf = MemoryBuffer::getFile(pathOf(H));
+  if (!Buf)
+    return false;
+
+  SmallVector<StringRef, 64> Lines;
+  (*Buf)->getBuffer().split(Lines, '\n', -1, false);
+  if (Lines.empty() || Lines[0] != SummaryMagic)
+    return false;
+
+  for (unsigned i = 1; i < Lines.size(); ++i) {
+    StringRef Line = Lines[i];
+    StringRef Tag;
+    std::tie(Tag, Line) = Line.split(' ');
+
+    if (Tag == "sites") {
+      S.HasSites = true;
+    } else if (Tag == "ids") {
+      if (Line.getAsInteger(10, S.IdsKey))
+        return false;
+      S.HasIds = true;
+    } else if (Tag == "site") {
+      SmallVector<StringRef, 5> Fields;
+      Line.split(Fields, ' ');
+      FuncSummary::Site Site;
+      if (Fields.size() != 5 || Fields[0].getAsInteger(10, Site.Kind) ||
+          Fields[1].getAsInteger(10, Site.Call) ||
+          Fields[2].getAsInteger(10, Site.Type) ||
+          Fields[3].getAsInteger(10, Site.Arg) ||
+          Fields[4].getAsInteger(10, Site.Field))
+        return false;
+      S.Sites.push_back(Site);
+    } else if (Tag == "id") {
+      StringRef Ord, Id;
+      std::tie(Ord, Id) = Line.split(' ');
+      unsigned N;
+      if (Ord.getAsInteger(10, N) || Id.empty())
+        return false;
+      S.Ids.push_back(std::make_pair(N, Id.str()));
+    } else {
+      return false;
+    }
+  }
+  return true;
+}
+
+bool SummaryCache::store(uint64_t H, const FuncSummary &S) const {
+  std::string Path = pathOf(H);
+  // write aside and rename, concurrent runs never see half a summary
+  std::string Tmp =
+      Path + ".tmp" + std::to_string(sys::Process::getProcessId());
+
+  {
+    std::error_code EC;
+    raw_fd_ostream OS(Tmp, EC, sys::fs::OF_Text);
+    if (EC)
+      return false;
+
+    OS << SummaryMagic << "\n";
+    if (S.HasSites) {
+      OS << "sites\n";
+      for (auto &Site : S.Sites)
+        OS << "site " << Site.Kind << " " << Site.Call << " " << Site.Type
+           << " " << Site.Arg << " " << Site.Field << "\n";
+    }
+    if (S.HasIds) {
+      OS << "ids " << S.IdsKey << "\n";
+      for (auto &Id : S.Ids)
+        OS << "id " << Id.first << " " << Id.second << "\n";
+    }
+    if (OS.has_error()) {
+      OS.clear_error();
+      sys::fs::remove(Tmp);
+      return false;
+    }
+  }
+
+  return !sys::fs::rename(Tmp, Path);
+}
@@ -0,0 +1,88 @@
+#ifndef _SUMMARY_CACHE_H
+#define _SUMMARY_CACHE_H
+
+#include <llvm/ADT/DenseMap.h>
+#include <llvm/IR/Function.h>
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Facts about one function body that only depend on the body itself.
+// Instructions are referred to by their ordinal in the body (debug
+// intrinsics skipped, the same numbering the body hash uses), so a
+// summary written by one run applies to any function hashing the same.
+struct FuncSummary {
+  // one CredAnalysis finding: Call is the call site, Type the instruction
+  // the struct type is read off (cast, GEP or return), Arg the freed
+  // argument of a free site
+  struct Site {
+    unsigned Kind;
+    unsigned Call;
+    unsigned Type;
+    unsigned Arg;
+    uint64_t Field;
+  };
+
+  bool HasSites = false;
+  std::vector<Site> Sites;
+
+  // annotation ids of the function pointer loads and stores, for the
+  // names and locations hashing to IdsKey (see hashFunctionNames)
+  bool HasIds = false;
+  uint64_t IdsKey = 0;
+  std::vector<std::pair<unsigned, std::string>> Ids;
+
+  bool Dirty = false;
+};
+
+// Per-function summaries persisted in a directory, one file per body hash.
+// Summaries are read lazily on first use and written back by flush(), so a
+// rerun after a small source change only re-analyzes the functions whose
+// bodies changed. Without a directory they only live in memory, for the
+// analyzers sharing the cache.
+class SummaryCache {
+public:
+  explicit SummaryCache(const std::string &Dir);
+
+  // summary of the body hashing to H, empty if it was never analyzed.
+  // safe to call from pool workers.
+  FuncSummary *get(uint64_t H);
+
+  // write every summary filled in since the last flush
+  void flush();
+
+  unsigned hits() const { return Hits; }
+  unsigned misses() const { return Misses; }
+
+private:
+  std::string pathOf(uint64_t H) const;
+  bool load(uint64_t H, FuncSummary &S) const;
+  bool store(uint64_t H, const FuncSummary &S) const;
+
+  std::string Dir;
+
+  std::mutex Lock;
+  std::unordered_map<uint64_t, std::unique_ptr<FuncSummary>> Summaries;
+  std::atomic<unsigned> Hits, Misses;
+};
+
+// summary of F's body, null without a cache or if F was not hashed
+static inline FuncSummary *
+getSummary(SummaryCache *Summaries,
+           const llvm::DenseMap<llvm::Function *, size_t> &Hashes,
+           llvm::Function *F) {
+  if (!Summaries)
+    return nullptr;
+  auto itr = Hashes.find(F);
+  return itr == Hashes.end() ? nullptr : Summaries->get(itr->second);
+}
+
+// instructions of F in summary ordinal order
+void getSummaryInsts(llvm::Function *F,
+                     std::vector<llvm::Instruction *> &Insts);
+
+#endif
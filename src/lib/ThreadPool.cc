@@ -0,0 +1,124 @@
+/*
+ * Work-stealing thread pool
+ *
+ * For licensing details see LICENSE
+ */
+
+#include "ThreadPool.h"
+
+WorkStealingPool::WorkStealingPool(unsigned NumThreads)
+    : NumWorkers(NumThreads ? NumThreads : 1), CurFn(nullptr), JobGen(0),
+      Pending(0), Active(0), Stop(false) {
+  for (unsigned i = 0; i < NumWorkers; ++i)
+    Workers.emplace_back(new Worker());
+
+  // worker 0 is whoever calls parallelFor()
+  for (unsigned i = 1; i < NumWorkers; ++i)
+    Threads.emplace_back(&WorkStealingPool::workerLoop, this, i);
+}
+
+WorkStealingPool::~WorkStealingPool() {
+  {
+    std::lock_guard<std::mutex> Guard(JobLock);
+    Stop = true;
+  }
+  JobCV.notify_all();
+  for (auto &T : Threads)
+    T.join();
+}
+
+bool WorkStealingPool::popLocal(unsigned W, Range &R) {
+  Worker &Self = *Workers[W];
+  std::lock_guard<std::mutex> Guard(Self.Lock);
+  if (Self.Tasks.empty())
+    return false;
+  R = Self.Tasks.back();
+  Self.Tasks.pop_back();
+  return true;
+}
+
+bool WorkStealingPool::steal(unsigned W, Range &R) {
+  for (unsigned i = 1; i < NumWorkers; ++i) {
+    Worker &Victim = *Workers[(W + i) % NumWorkers];
+    std::lock_guard<std::mutex> Guard(Victim.Lock);
+    if (Victim.Tasks.empty())
+      continue;
+    R = Victim.Tasks.front();
+    Victim.Tasks.pop_front();
+    return true;
+  }
+  return false;
+}
+
+void WorkStealingPool::runTasks(unsigned W, const TaskFn &Fn) {
+  Range R;
+  while (popLocal(W, R) || steal(W, R)) {
+    for (size_t i = R.begin; i < R.end; ++i)
+      Fn(i, W);
+
+    if (Pending.fetch_sub(1) == 1) {
+      std::lock_guard<std::mutex> Guard(JobLock);
+      DoneCV.notify_all();
+    }
+  }
+}
+
+void WorkStealingPool::workerLoop(unsigned W) {
+  unsigned long Seen = 0;
+  while (true) {
+    const TaskFn *Fn;
+    {
+      std::unique_lock<std::mutex> Guard(JobLock);
+      JobCV.wait(Guard, [&] { return Stop || JobGen != Seen; });
+      if (Stop)
+        return;
+      Seen = JobGen;
+      Fn = CurFn;
+      ++Active;
+    }
+    runTasks(W, *Fn);
+    {
+      std::lock_guard<std::mutex> Guard(JobLock);
+      --Active;
+    }
+    DoneCV.notify_all();
+  }
+}
+
+void WorkStealingPool::parallelFor(size_t N, const TaskFn &Fn, size_t Grain) {
+  if (N == 0)
+    return;
+
+  if (NumWorkers == 1 || N == 1) {
+    for (size_t i = 0; i < N; ++i)
+      Fn(i, 0);
+    return;
+  }
+
+  // a few chunks per worker leaves room for stealing to even out the load
+  if (Grain == 0)
+    Grain = std::max<size_t>(1, N / (NumWorkers * 8));
+
+  {
+    // stragglers from the previous job still hold its task function, let
+    // them leave before new chunks become visible
+    std::unique_lock<std::mutex> Guard(JobLock);
+    DoneCV.wait(Guard, [&] { return Active == 0; });
+
+    size_t Chunks = 0;
+    for (size_t begin = 0; begin < N; begin += Grain, ++Chunks) {
+      Worker &Owner = *Workers[Chunks % NumWorkers];
+      std::lock_guard<std::mutex> OwnerGuard(Owner.Lock);
+      Owner.Tasks.push_back({begin, std::min(N, begin + Grain)});
+    }
+    Pending = Chunks;
+    CurFn = &Fn;
+    ++JobGen;
+  }
+  JobCV.notify_all();
+
+  runTasks(0, Fn);
+
+  std::unique_lock<std::mutex> Guard(JobLock);
+  DoneCV.wait(Guard, [&] { return Pending.load() == 0; });
+}
@@ -0,0 +1,103 @@
+#ifndef _THREAD_POOL_H
+#define _THREAD_POOL_H
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// A small work-stealing pool for function-granularity tasks inside a module.
+// parallelFor() chops [0, N) into chunks and deals them out to per-worker
+// deques; a worker pops from the back of its own deque and steals from the
+// front of the others once it runs dry. The calling thread takes part as
+// worker 0, so results can be collected in one buffer per worker id and
+// merged after the call returns. Tasks must not call parallelFor() again.
+class WorkStealingPool {
+public:
+  typedef std::function<void(size_t, unsigned)> TaskFn;
+
+  explicit WorkStealingPool(unsigned NumThreads);
+  ~WorkStealingPool();
+
+  // number of workers, including the calling thread
+  unsigned size() const { return NumWorkers; }
+
+  // run Fn(index, worker) for every index in [0, N) and wait for all of them
+  void parallelFor(size_t N, const TaskFn &Fn, size_t Grain = 0);
+
+private:
+  struct Range {
+    size_t begin, end;
+  };
+
+  struct Worker {
+    std::mutex Lock;
+    std::deque<Range> Tasks;
+  };
+
+  bool popLocal(unsigned W, Range &R);
+  bool steal(unsigned W, Range &R);
+  void runTasks(unsigned W, const TaskFn &Fn);
+  void workerLoop(unsigned W);
+
+  unsigned NumWorkers;
+  std::vector<std::unique_ptr<Worker>> Workers;
+  std::vector<std::thread> Threads;
+
+  std::mutex JobLock;
+  std::condition_variable JobCV;
+  std::condition_variable DoneCV;
+  const TaskFn *CurFn;
+  unsigned long JobGen;
+  std::atomic<size_t> Pending;
+  unsigned Active;
+  bool Stop;
+};
+
+// Fixed-capacity FIFO between the stages of a pipeline. push() blocks while
+// the queue is full, pop() blocks while it is empty and fails once the
+// queue has been closed and drained.
+template <typename T> class BoundedQueue {
+public:
+  explicit BoundedQueue(size_t Capacity)
+      : Capacity(Capacity ? Capacity : 1), Closed(false) {}
+
+  void push(T Item) {
+    std::unique_lock<std::mutex> Guard(Lock);
+    NotFull.wait(Guard, [this] { return Items.size() < Capacity; });
+    Items.push_back(std::move(Item));
+    NotEmpty.notify_one();
+  }
+
+  bool pop(T &Item) {
+    std::unique_lock<std::mutex> Guard(Lock);
+    NotEmpty.wait(Guard, [this] { return !Items.empty() || Closed; });
+    if (Items.empty())
+      return false;
+    Item = std::move(Items.front());
+    Items.pop_front();
+    NotFull.notify_one();
+    return true;
+  }
+
+  // no more pushes, wakes up every waiting consumer
+  void close() {
+    std::lock_guard<std::mutex> Guard(Lock);
+    Closed = true;
+    NotEmpty.notify_all();
+  }
+
+private:
+  size_t Capacity;
+  std::deque<T> Items;
+  std::mutex Lock;
+  std::condition_variable NotEmpty, NotFull;
+  bool Closed;
+};
+
+#endif